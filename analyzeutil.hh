@@ -10,11 +10,21 @@
 #include <charconv>
 #include <cstring>
 #include <fstream>
+#include <vector>
+#include <type_traits>
+#include <memory>
+#include <optional>
 #include <google/sparse_hash_map>
 #include <google/dense_hash_map>
 
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <arpa/inet.h>
+
+#include "floatutil.hh"
+#include "diagutil.hh"
+#include "zstdutil.hh"
+
 // #include <boost/fusion/adapted/struct.hpp>
 // #include <boost/fusion/include/for_each.hpp>
 using namespace std;
@@ -61,29 +71,6 @@ uint64_t to_uint64(string_view str) {
     return ret;
 }
 
-float to_float(const string_view str) {
-    /* sadly, g++ 8 doesn't seem to have floating-point C++17 from_chars() yet
-       float ret;
-       const auto [ptr, ignore] = from_chars(str.data(), str.data() + str.size(), ret);
-       if (ptr != str.data() + str.size()) {
-       throw runtime_error("could not parse as float: " + string(str));
-       }
-
-       return ret;
-       */
-
-    /* apologies for this */
-    char * const null_byte = const_cast<char *>(str.data() + str.size());
-    char old_value = *null_byte;
-    *null_byte = 0;
-
-    const float ret = atof(str.data());
-
-    *null_byte = old_value;
-
-    return ret;
-}
-
 template <typename T>
 T influx_integer(const string_view str) {
     if (str.back() != 'i') {
@@ -97,48 +84,251 @@ T influx_integer(const string_view str) {
     return static_cast<T>(ret_64);
 }
 
-class string_table {
-    uint32_t next_id_ = 0;
+/* Writes a CSV file through a large reusable buffer, flushed in big blocks.
+ * Numbers are formatted with to_chars (floats as the shortest string that round-trips),
+ * so writing a row does not allocate. */
+class CSVWriter {
+    static constexpr size_t BUFFER_SIZE = 1 << 20;
+    // enough for any number
+    static constexpr size_t MAX_NUMBER_LEN = 64;
+
+    string filename_;
+    ofstream file_{};
+    unique_ptr<ZstdFrameWriter> compressed_file_{};
+    vector<char> buffer_;
+    size_t used_ = 0;
+    uint64_t bytes_written_ = 0;
+
+    void write(const string_view data) {
+        bytes_written_ += data.size();
+        if (compressed_file_) {
+            compressed_file_->write(data);
+        } else {
+            file_.write(data.data(), data.size());
+        }
+    }
+
+    void flush() {
+        write({buffer_.data(), used_});
+        used_ = 0;
+    }
+
+    void reserve(const size_t len) {
+        if (used_ + len > buffer_.size()) {
+            flush();
+        }
+    }
+
+    public:
+    /* If zstd_threads > 0, filename is written zstd-compressed, on up to zstd_threads threads */
+    explicit CSVWriter(const string & filename, const unsigned zstd_threads = 0)
+        : filename_(filename), buffer_(BUFFER_SIZE)
+    {
+        if (zstd_threads > 0) {
+            compressed_file_ = make_unique<ZstdFrameWriter>(filename, zstd_threads);
+            return;
+        }
+        file_.open(filename);
+        if (not file_.is_open()) {
+            throw runtime_error( "can't open " + filename);
+        }
+    }
+
+    CSVWriter & operator<<(const string_view str) {
+        reserve(str.size());
+        if (str.size() > buffer_.size()) {
+            write(str);
+        } else {
+            memcpy(buffer_.data() + used_, str.data(), str.size());
+            used_ += str.size();
+        }
+        return *this;
+    }
+
+    CSVWriter & operator<<(const char ch) {
+        reserve(1);
+        buffer_[used_++] = ch;
+        return *this;
+    }
+
+    template <typename T, typename = enable_if_t<is_arithmetic_v<T>>>
+    CSVWriter & operator<<(const T number) {
+        reserve(MAX_NUMBER_LEN);
+        const auto [ptr, ec] = to_chars(buffer_.data() + used_, buffer_.data() + used_ + MAX_NUMBER_LEN, number);
+        if (ec != errc()) {
+            throw runtime_error("could not format number for " + filename_);
+        }
+        used_ = ptr - buffer_.data();
+        return *this;
+    }
+
+    /* Bytes of CSV flushed so far (before any compression); all of them after close() */
+    uint64_t bytes_written() const { return bytes_written_; }
+
+    /* Flush and close; throws if any write failed */
+    void close() {
+        flush();
+        if (compressed_file_) {
+            compressed_file_->close();
+            return;
+        }
+        file_.close();
+        if (file_.bad()) {
+            throw runtime_error("error writing " + filename_);
+        }
+    }
+};
+
+/* Compile-time perfect hash from a fixed list of names to their index in the list
+ * (or N, if not in the list). A name is hashed by its length and first and last characters,
+ * then confirmed with a single comparison. Constructing one in a constexpr context fails
+ * to compile if two names hash to the same slot. */
+template <size_t N>
+class name_dispatch {
+    static constexpr size_t TABLE_SIZE = 64;
+    static_assert(N < TABLE_SIZE);
+
+    array<string_view, N> names_;
+    array<uint8_t, TABLE_SIZE> slots_;
+
+    static constexpr size_t hash(const string_view name) {
+        return (name.size() * 10 + uint8_t(name.front()) + uint8_t(name.back()) * 4) % TABLE_SIZE;
+    }
+
+    public:
+    constexpr name_dispatch(const array<string_view, N> & names) 
+        : names_(names), slots_() 
+    {
+        for (auto & slot : slots_) { slot = N; }
+        for (size_t i = 0; i < N; i++) {
+            if (names[i].empty() or slots_[hash(names[i])] != N) {
+                throw logic_error("name_dispatch: empty or colliding name");
+            }
+            slots_[hash(names[i])] = i;
+        }
+    }
+
+    constexpr size_t operator()(const string_view name) const {
+        if (name.empty()) {
+            return N;
+        }
+        const size_t i = slots_[hash(name)];
+        return (i < N and names_[i] == name) ? i : N;
+    }
+
+    constexpr string_view name(const size_t i) const { return names_.at(i); }
+};
+
+/* Measurements that may appear in the export (see influx_to_csv's Parser::parse_line()) */
+enum class Measurement : uint8_t {
+    client_buffer, active_streams, backlog, channel_status, client_error, client_sysinfo,
+    decoder_info, server_info, ssim, video_acked, video_sent, video_size,
+    unknown
+};
+
+constexpr size_t N_MEASUREMENTS = size_t(Measurement::unknown);
+
+constexpr name_dispatch<N_MEASUREMENTS> measurements{{
+    "client_buffer", "active_streams", "backlog", "channel_status", "client_error", "client_sysinfo",
+    "decoder_info", "server_info", "ssim", "video_acked", "video_sent", "video_size"
+}};
 
-    dense_hash_map<string, uint32_t> forward_{};
-    dense_hash_map<uint32_t, string> reverse_{};
+/* Field keys of all parsed measurements (each measurement accepts a subset) */
+enum class FieldKey : uint8_t { 
+    first_init_id, init_id, expt_id, user, event, buffer, cum_rebuf, cum_rebuffer,
+    browser, os, ip, screen_width, screen_height, 
+    ssim_index, delivery_rate, size, video_ts, cwnd, in_flight, min_rtt, rtt, format, timestamp,
+    unknown 
+};
+
+constexpr name_dispatch<size_t(FieldKey::unknown)> field_keys{{
+    "first_init_id", "init_id", "expt_id", "user", "event", "buffer", "cum_rebuf", "cum_rebuffer",
+    "browser", "os", "ip", "screen_width", "screen_height",
+    "ssim_index", "delivery_rate", "size", "video_ts", "cwnd", "in_flight", "min_rtt", "rtt", "format", "timestamp"
+}};
+
+FieldKey to_field_key(const string_view key) {
+    return FieldKey(field_keys(key));
+}
+
+/* Interns strings as dense ids (assigned from 0, in the order keys were first seen).
+ * Each string is stored once, in an arena of fixed-size blocks (so views into it stay valid
+ * as the table grows); forward lookups are keyed by views into the arena. */
+class string_table {
+    static constexpr size_t ARENA_BLOCK_SIZE = 64 * 1024;
+
+    vector<unique_ptr<char[]>> arena_{};
+    size_t block_used_ = ARENA_BLOCK_SIZE;  // in arena_.back()
+
+    dense_hash_map<string_view, uint32_t, hash<string_view>> forward_{};
+    vector<string_view> reverse_{};     // reverse_[id] = key
+
+    /* Copy key into the arena, returning a view of the copy */
+    string_view store(const string_view key) {
+        if (key.size() > ARENA_BLOCK_SIZE) {
+            // too big to share a block: give it its own, keeping the current block at the back
+            const auto block = arena_.insert(arena_.empty() ? arena_.end() : prev(arena_.end()),
+                                             make_unique<char[]>(key.size()));
+            memcpy(block->get(), key.data(), key.size());
+            return {block->get(), key.size()};
+        }
+        if (ARENA_BLOCK_SIZE - block_used_ < key.size()) {
+            arena_.emplace_back(make_unique<char[]>(ARENA_BLOCK_SIZE));
+            block_used_ = 0;
+        }
+        char * const dest = arena_.back().get() + block_used_;
+        memcpy(dest, key.data(), key.size());
+        block_used_ += key.size();
+        return {dest, key.size()};
+    }
 
     public:
     string_table() {
-        forward_.set_empty_key({});
-        reverse_.set_empty_key(-1);
+        forward_.set_empty_key({});     // so the empty string can't be a key
     }
 
     /* Return map[key], inserting if necessary. */
-    uint32_t forward_map_vivify(const string & key) {
-        auto ref = forward_.find(key);
-        if (ref == forward_.end()) {	
-            forward_[key] = next_id_;
-            reverse_[next_id_] = key;
-            next_id_++;
-            ref = forward_.find(key);
+    uint32_t forward_map_vivify(const string_view key) {
+        const auto ref = forward_.find(key);
+        if (ref != forward_.end()) {
+            return ref->second;
         }
-        return ref->second;
+        const uint32_t id = reverse_.size();
+        const string_view stored = store(key);
+        forward_.insert({stored, id});
+        reverse_.emplace_back(stored);
+        return id;
     }
 
     /* Return map.at(key), throwing if not found. */
-    uint32_t forward_map(const string & key) const {
+    uint32_t forward_map(const string_view key) const {
         auto ref = forward_.find(key);
         if (ref == forward_.end()) {	
-            throw runtime_error( "key " + key + " not found");
+            throw runtime_error( "key " + string(key) + " not found");
         }
         return ref->second;
     }
 
-    const string & reverse_map(const uint32_t id) const {
-        auto ref = reverse_.find(id);
-        if (ref == reverse_.end()) {
+    string_view reverse_map(const uint32_t id) const {
+        if (id >= reverse_.size()) {
             throw runtime_error( "id " + to_string(id) + " not found");
         }
-        return ref->second;
+        return reverse_[id];
     }
+
+    /* Ids are assigned densely from 0, in the order keys were first seen. */
+    uint32_t size() const { return reverse_.size(); }
 };
 
+/* Returns a packed field (see Event) as an optional: empty unless its bit is set in present */
+template <typename T>
+optional<T> packed_field(const unsigned present, const unsigned bit, const T & field) {
+    if (present & bit) {
+        return field;
+    }
+    return nullopt;
+}
+
 struct Event {
     struct EventType {
         enum class Type : uint8_t { init, startup, play, timer, rebuffer };
@@ -148,15 +338,18 @@ struct Event {
 
         operator string_view() const { return names[uint8_t(type)]; }
 
+        constexpr static name_dispatch<names.size()> types{names};
+
+        EventType() : type() {}
+
         EventType(const string_view sv)
             : type()
         {
-            if (sv == "timer"sv) { type = Type::timer; }
-            else if (sv == "play"sv) { type = Type::play; }
-            else if (sv == "rebuffer"sv) { type = Type::rebuffer; }
-            else if (sv == "init"sv) { type = Type::init; }
-            else if (sv == "startup"sv) { type = Type::startup; }
-            else { throw runtime_error( "unknown event type: " + string(sv) ); }
+            const size_t type_index = types(sv);
+            if (type_index == names.size()) { 
+                throw runtime_error( "unknown event type: " + string(sv) ); 
+            }
+            type = Type(type_index);
         }
 
         operator uint8_t() const { return static_cast<uint8_t>(type); }
@@ -167,15 +360,44 @@ struct Event {
         bool operator!=(const EventType::Type other) const { return not operator==(other); }
     };
 
+    /* Fields are stored packed, with one presence bit each in present_ 
+     * (rather than as optionals, each with its own flag and padding). */
+    enum Field : uint8_t {
+        FIRST_INIT_ID = 1 << 0, INIT_ID = 1 << 1, EXPT_ID = 1 << 2, USER_ID = 1 << 3,
+        TYPE = 1 << 4, BUFFER = 1 << 5, CUM_REBUF = 1 << 6
+    };
+    // all fields but first_init_id
+    static constexpr uint8_t MANDATORY = INIT_ID | EXPT_ID | USER_ID | TYPE | BUFFER | CUM_REBUF;
+
+    private:
     /* After 11/27, all measurements are recorded with both first_init_id (identifies session) 
      * and init_id (identifies stream). Before 11/27, only init_id is recorded. */
-    optional<uint32_t> first_init_id{}; // optional
-    optional<uint32_t> init_id{};       // mandatory
-    optional<uint32_t> expt_id{};
-    optional<uint32_t> user_id{};
-    optional<EventType> type{};
-    optional<float> buffer{};
-    optional<float> cum_rebuf{};
+    uint32_t first_init_id_{}; // optional
+    uint32_t init_id_{};       // mandatory
+    uint32_t expt_id_{};
+    uint32_t user_id_{};
+    float buffer_{};
+    float cum_rebuf_{};
+    EventType type_{};
+    uint8_t present_ = 0;
+
+    public:
+    bool bad = false;
+
+    Event() = default;
+
+    /* Event with only its anonymous fields set (e.g. as read back from csv) */
+    Event(const uint32_t expt_id, const EventType type, const float buffer, const float cum_rebuf)
+        : expt_id_(expt_id), buffer_(buffer), cum_rebuf_(cum_rebuf), type_(type), 
+          present_(EXPT_ID | TYPE | BUFFER | CUM_REBUF) {}
+
+    optional<uint32_t> first_init_id() const { return packed_field(present_, FIRST_INIT_ID, first_init_id_); }
+    optional<uint32_t> init_id() const { return packed_field(present_, INIT_ID, init_id_); }
+    optional<uint32_t> expt_id() const { return packed_field(present_, EXPT_ID, expt_id_); }
+    optional<uint32_t> user_id() const { return packed_field(present_, USER_ID, user_id_); }
+    optional<EventType> type() const { return packed_field(present_, TYPE, type_); }
+    optional<float> buffer() const { return packed_field(present_, BUFFER, buffer_); }
+    optional<float> cum_rebuf() const { return packed_field(present_, CUM_REBUF, cum_rebuf_); }
 
     // Comma-separated anonymous keys and values (to be dumped).
     static string anon_keys() { 
@@ -184,40 +406,38 @@ struct Event {
                VAR_NAME(buffer) + "," +
                VAR_NAME(cum_rebuf);
     }
-    string anon_values() const { 
-        ostringstream values;
-        values << string_view(type.value()) << "," 
-               << buffer.value() << "," 
-               << cum_rebuf.value();
-        return values.str();
-
+    void write_anon_values(CSVWriter & values) const { 
+        values << string_view(type_) << "," 
+               << buffer_ << "," 
+               << cum_rebuf_;
     }
     // Makes templatizing easier, and enforces that dump() calls the correct function
     // Should only be called on complete datapoints
-    string anon_values(const string_table & formats __attribute((unused)) ) const { 
+    void write_anon_values(CSVWriter & values __attribute((unused)),
+                           const string_table & formats __attribute((unused)) ) const { 
         throw logic_error("Event does not use formats table to retrieve anonymous values");
     }
 
-    bool bad = false;
-
     // Event is "complete" and "good" if all mandatory fields are set exactly once
     bool complete() const {
-        return init_id.has_value() and expt_id.has_value() and user_id.has_value()
-            and type.has_value() and buffer.has_value() and cum_rebuf.has_value();
+        return (present_ & MANDATORY) == MANDATORY;
     }
 
     template <typename T>
-        void set_unique( optional<T> & field, const T & value ) {
-            if (not field.has_value()) { 
-                field.emplace(value);
+        void set_unique( const Field bit, T & field, const T & value ) {
+            if (not (present_ & bit)) { 
+                field = value;
+                present_ |= bit;
             } else {
-                if (field.value() != value) {
+                if (field != value) {
                     if (not bad) {
                         bad = true;
-                        cerr << "error trying to set contradictory event value " << value <<
-                                " (old value " << field.value() << ")\n";
-                        cerr << "Contradictory event with old value:\n";
-                        cerr << *this;   
+                        diagnostics().report("contradictory_event", [&](ostream & out) {
+                            out << "error trying to set contradictory event value " << value <<
+                                   " (old value " << field << ")\n";
+                            out << "Contradictory event with old value:\n";
+                            out << *this;
+                        });
                     }
                     // throw runtime_error( "contradictory values: " + to_string(field.value()) + " vs. " + to_string(value) );
                 }
@@ -227,38 +447,64 @@ struct Event {
     /* Set field corresponding to key, if not yet set for this Event.
      * If field is already set with a different value, Event is "bad" */
     void insert_unique(const string_view key, const string_view value, string_table & usernames ) {
-        if (key == "first_init_id"sv) {
-            set_unique( first_init_id, influx_integer<uint32_t>( value ) );
-        } else if (key == "init_id"sv) {
-            set_unique( init_id, influx_integer<uint32_t>( value ) );
-        } else if (key == "expt_id"sv) {
-            set_unique( expt_id, influx_integer<uint32_t>( value ) );
-        } else if (key == "user"sv) {
+        switch (to_field_key(key)) {
+        case FieldKey::first_init_id:
+            set_unique( FIRST_INIT_ID, first_init_id_, influx_integer<uint32_t>( value ) );
+            break;
+        case FieldKey::init_id:
+            set_unique( INIT_ID, init_id_, influx_integer<uint32_t>( value ) );
+            break;
+        case FieldKey::expt_id:
+            set_unique( EXPT_ID, expt_id_, influx_integer<uint32_t>( value ) );
+            break;
+        case FieldKey::user:
             if (value.size() <= 2 or value.front() != '"' or value.back() != '"') {
                 throw runtime_error("invalid username string: " + string(value));
             }
-            set_unique( user_id, usernames.forward_map_vivify(string(value.substr(1,value.size()-2))) );
-        } else if (key == "event"sv) {
-            set_unique( type, { value.substr(1,value.size()-2) } );
-        } else if (key == "buffer"sv) {
-            set_unique( buffer, to_float(value) );
-        } else if (key == "cum_rebuf"sv) {
-            set_unique( cum_rebuf, to_float(value) );
-        } else {
+            set_unique( USER_ID, user_id_, usernames.forward_map_vivify(value.substr(1,value.size()-2)) );
+            break;
+        case FieldKey::event:
+            set_unique( TYPE, type_, EventType{ value.substr(1,value.size()-2) } );
+            break;
+        case FieldKey::buffer:
+            set_unique( BUFFER, buffer_, to_float(value) );
+            break;
+        case FieldKey::cum_rebuf:
+            set_unique( CUM_REBUF, cum_rebuf_, to_float(value) );
+            break;
+        default:
             throw runtime_error( "unknown key: " + string(key) );
         }
     }
 
+    /* Set each field recorded in other, as if other's lines had been parsed after this Event's 
+     * (ids in other must already be translated to this Event's tables) */
+    void merge(const Event & other) {
+        if (other.present_ & FIRST_INIT_ID) { set_unique( FIRST_INIT_ID, first_init_id_, other.first_init_id_ ); }
+        if (other.present_ & INIT_ID) { set_unique( INIT_ID, init_id_, other.init_id_ ); }
+        if (other.present_ & EXPT_ID) { set_unique( EXPT_ID, expt_id_, other.expt_id_ ); }
+        if (other.present_ & USER_ID) { set_unique( USER_ID, user_id_, other.user_id_ ); }
+        if (other.present_ & TYPE) { set_unique( TYPE, type_, other.type_ ); }
+        if (other.present_ & BUFFER) { set_unique( BUFFER, buffer_, other.buffer_ ); }
+        if (other.present_ & CUM_REBUF) { set_unique( CUM_REBUF, cum_rebuf_, other.cum_rebuf_ ); }
+        bad = bad or other.bad;
+    }
+
+    /* Translate user_id (if set) to another usernames table: user_id => id_map[user_id] */
+    void remap_user_id(const vector<uint32_t> & id_map) {
+        if (present_ & USER_ID) { user_id_ = id_map.at(user_id_); }
+    }
+
     friend std::ostream& operator<<(std::ostream& out, const Event& s); 
 };
 std::ostream& operator<< (std::ostream& out, const Event& s) {        
-    return out << "init_id=" << s.init_id.value_or(-1)
-        << ", expt_id=" << s.expt_id.value_or(-1)
-        << ", user_id=" << s.user_id.value_or(-1)
-        << ", type=" << (s.type.has_value() ? int(s.type.value()) : 'x')
-        << ", buffer=" << s.buffer.value_or(-1.0)
-        << ", cum_rebuf=" << s.cum_rebuf.value_or(-1.0)
-        << ", first_init_id=" << s.first_init_id.value_or(-1)
+    return out << "init_id=" << s.init_id().value_or(-1)
+        << ", expt_id=" << s.expt_id().value_or(-1)
+        << ", user_id=" << s.user_id().value_or(-1)
+        << ", type=" << (s.type().has_value() ? int(s.type().value()) : 'x')
+        << ", buffer=" << s.buffer().value_or(-1.0)
+        << ", cum_rebuf=" << s.cum_rebuf().value_or(-1.0)
+        << ", first_init_id=" << s.first_init_id().value_or(-1)
         << "\n";
 }
 
@@ -301,10 +547,12 @@ struct Sysinfo {
                 if (field.value() != value) {
                     if (not bad) {
                         bad = true;
-                        cerr << "error trying to set contradictory sysinfo value " << value <<
-                                " (old value " << field.value() << ")\n";
-                        cerr << "Contradictory sysinfo:\n";
-                        cerr << *this; 
+                        diagnostics().report("contradictory_sysinfo", [&](ostream & out) {
+                            out << "error trying to set contradictory sysinfo value " << value <<
+                                   " (old value " << field.value() << ")\n";
+                            out << "Contradictory sysinfo:\n";
+                            out << *this;
+                        });
                     }
                     // throw runtime_error( "contradictory values: " + to_string(field.value()) + " vs. " + to_string(value) );
                 }
@@ -314,34 +562,57 @@ struct Sysinfo {
             string_table & usernames,
             string_table & browsers,
             string_table & ostable ) {
-        if (key == "first_init_id"sv) {
+        switch (to_field_key(key)) {
+        case FieldKey::first_init_id:
             set_unique( first_init_id, influx_integer<uint32_t>( value ) );
-        } else if (key == "init_id"sv) {
+            break;
+        case FieldKey::init_id:
             set_unique( init_id, influx_integer<uint32_t>( value ) );
-        } else if (key == "expt_id"sv) {
+            break;
+        case FieldKey::expt_id:
             set_unique( expt_id, influx_integer<uint32_t>( value ) );
-        } else if (key == "user"sv) {
+            break;
+        case FieldKey::user:
             if (value.size() <= 2 or value.front() != '"' or value.back() != '"') {
                 throw runtime_error("invalid username string: " + string(value));
             }
-            set_unique( user_id, usernames.forward_map_vivify(string(value.substr(1,value.size()-2))) );
-        } else if (key == "browser"sv) {
+            set_unique( user_id, usernames.forward_map_vivify(value.substr(1,value.size()-2)) );
+            break;
+        case FieldKey::browser:
             // Insert browser to string => id map; store id
-            set_unique( browser_id, browsers.forward_map_vivify(string(value.substr(1,value.size()-2))) );
-        } else if (key == "os"sv) {
+            set_unique( browser_id, browsers.forward_map_vivify(value.substr(1,value.size()-2)) );
+            break;
+        case FieldKey::os: {
             string osname(value.substr(1,value.size()-2));
             for (auto & x : osname) {
                 if ( x == ' ' ) { x = '_'; }
             }
             set_unique( os, ostable.forward_map_vivify(osname) );
-        } else if (key == "ip"sv) {
+            break;
+        }
+        case FieldKey::ip:
             set_unique( ip, inet_addr(string(value.substr(1,value.size()-2)).c_str()) );
-        } else if (key == "screen_width"sv or key == "screen_height"sv) {
+            break;
+        case FieldKey::screen_width:
+        case FieldKey::screen_height:
             // ignore
-        } else {
+            break;
+        default:
             throw runtime_error( "unknown key: " + string(key) );
         }
     }
+
+    /* See Event::merge() */
+    void merge(const Sysinfo & other) {
+        if (other.browser_id) { set_unique( browser_id, *other.browser_id ); }
+        if (other.expt_id) { set_unique( expt_id, *other.expt_id ); }
+        if (other.user_id) { set_unique( user_id, *other.user_id ); }
+        if (other.first_init_id) { set_unique( first_init_id, *other.first_init_id ); }
+        if (other.init_id) { set_unique( init_id, *other.init_id ); }
+        if (other.os) { set_unique( os, *other.os ); }
+        if (other.ip) { set_unique( ip, *other.ip ); }
+        bad = bad or other.bad;
+    }
     friend std::ostream& operator<<(std::ostream& out, const Sysinfo& s); 
 };
 std::ostream& operator<< (std::ostream& out, const Sysinfo& s) {        
@@ -356,11 +627,55 @@ std::ostream& operator<< (std::ostream& out, const Sysinfo& s) {
 }
 
 struct VideoSent {
-    optional<float> ssim_index{};
-    optional<uint32_t> delivery_rate{}, expt_id{}, init_id{}, first_init_id{}, user_id{}, size{},
-    format{}, cwnd{}, in_flight{}, min_rtt{}, rtt{};
-    optional<uint64_t> video_ts{};
-    optional<float> buffer{}, cum_rebuf{};
+    /* Fields are stored packed, with one presence bit each in present_ (see Event) */
+    enum Field : uint16_t {
+        SSIM_INDEX = 1 << 0, DELIVERY_RATE = 1 << 1, EXPT_ID = 1 << 2, INIT_ID = 1 << 3,
+        FIRST_INIT_ID = 1 << 4, USER_ID = 1 << 5, SIZE = 1 << 6, FORMAT = 1 << 7,
+        CWND = 1 << 8, IN_FLIGHT = 1 << 9, MIN_RTT = 1 << 10, RTT = 1 << 11,
+        VIDEO_TS = 1 << 12, BUFFER = 1 << 13, CUM_REBUF = 1 << 14
+    };
+    // all fields but first_init_id
+    static constexpr uint16_t MANDATORY = (1 << 15) - 1 - FIRST_INIT_ID;
+
+    private:
+    uint64_t video_ts_{};
+    uint32_t delivery_rate_{}, expt_id_{}, init_id_{}, first_init_id_{}, user_id_{}, size_{},
+    format_{}, cwnd_{}, in_flight_{}, min_rtt_{}, rtt_{};
+    float ssim_index_{}, buffer_{}, cum_rebuf_{};
+    uint16_t present_ = 0;
+
+    public:
+    bool bad = false;
+
+    VideoSent() = default;
+
+    /* VideoSent with only its anonymous fields (other than buffer/cum_rebuf) set 
+     * (e.g. as read back from csv) */
+    VideoSent(const float ssim_index, const uint32_t delivery_rate, const uint32_t expt_id,
+              const uint32_t size, const uint32_t format, const uint32_t cwnd, 
+              const uint32_t in_flight, const uint32_t min_rtt, const uint32_t rtt, 
+              const uint64_t video_ts)
+        : video_ts_(video_ts), delivery_rate_(delivery_rate), expt_id_(expt_id), size_(size), 
+          format_(format), cwnd_(cwnd), in_flight_(in_flight), min_rtt_(min_rtt), rtt_(rtt),
+          ssim_index_(ssim_index),
+          present_(SSIM_INDEX | DELIVERY_RATE | EXPT_ID | SIZE | FORMAT | CWND | IN_FLIGHT 
+                   | MIN_RTT | RTT | VIDEO_TS) {}
+
+    optional<float> ssim_index() const { return packed_field(present_, SSIM_INDEX, ssim_index_); }
+    optional<uint32_t> delivery_rate() const { return packed_field(present_, DELIVERY_RATE, delivery_rate_); }
+    optional<uint32_t> expt_id() const { return packed_field(present_, EXPT_ID, expt_id_); }
+    optional<uint32_t> init_id() const { return packed_field(present_, INIT_ID, init_id_); }
+    optional<uint32_t> first_init_id() const { return packed_field(present_, FIRST_INIT_ID, first_init_id_); }
+    optional<uint32_t> user_id() const { return packed_field(present_, USER_ID, user_id_); }
+    optional<uint32_t> size() const { return packed_field(present_, SIZE, size_); }
+    optional<uint32_t> format() const { return packed_field(present_, FORMAT, format_); }
+    optional<uint32_t> cwnd() const { return packed_field(present_, CWND, cwnd_); }
+    optional<uint32_t> in_flight() const { return packed_field(present_, IN_FLIGHT, in_flight_); }
+    optional<uint32_t> min_rtt() const { return packed_field(present_, MIN_RTT, min_rtt_); }
+    optional<uint32_t> rtt() const { return packed_field(present_, RTT, rtt_); }
+    optional<uint64_t> video_ts() const { return packed_field(present_, VIDEO_TS, video_ts_); }
+    optional<float> buffer() const { return packed_field(present_, BUFFER, buffer_); }
+    optional<float> cum_rebuf() const { return packed_field(present_, CUM_REBUF, cum_rebuf_); }
 
     // Comma-separated anonymous keys and values (to be dumped).
     static string anon_keys() { 
@@ -377,66 +692,63 @@ struct VideoSent {
                VAR_NAME(cum_rebuf); 
     }
     // Makes templatizing easier, and enforces that dump() calls the correct function
-    string anon_values() const { 
+    void write_anon_values(CSVWriter & values __attribute((unused)) ) const { 
         throw logic_error("VideoSent requires formats table to retrieve anonymous values");
     }
     // Should only be called on complete datapoints
-    string anon_values(const string_table & formats) const { 
-        ostringstream values;
-        values << video_ts.value() << ","
-               << formats.reverse_map(format.value()) << ","
-               << size.value() << ","
-               << ssim_index.value() << ","
-               << cwnd.value() << ","
-               << in_flight.value() << ","
-               << min_rtt.value() << ","
-               << rtt.value() << ","
-               << delivery_rate.value() << ","
-               << buffer.value() << ","
-               << cum_rebuf.value();
-        return values.str();
+    void write_anon_values(CSVWriter & values, const string_table & formats) const { 
+        values << video_ts_ << ","
+               << formats.reverse_map(format_) << ","
+               << size_ << ","
+               << ssim_index_ << ","
+               << cwnd_ << ","
+               << in_flight_ << ","
+               << min_rtt_ << ","
+               << rtt_ << ","
+               << delivery_rate_ << ","
+               << buffer_ << ","
+               << cum_rebuf_;
     }
 
-    bool bad = false;
-
     bool complete() const {
-        return ssim_index and delivery_rate and expt_id and init_id and user_id and size and
-               video_ts and cwnd and in_flight and min_rtt and rtt and format and
-               buffer and cum_rebuf;
+        return (present_ & MANDATORY) == MANDATORY;
     }
 
     bool operator==(const VideoSent & other) const {
-        return ssim_index == other.ssim_index
-            and delivery_rate == other.delivery_rate
-            and expt_id == other.expt_id
-            and init_id == other.init_id
-            and user_id == other.user_id
-            and size == other.size
-            and first_init_id == other.first_init_id
-            and video_ts == other.video_ts
-            and cwnd == other.cwnd
-            and in_flight == other.in_flight
-            and min_rtt == other.min_rtt
-            and rtt == other.rtt
-            and format == other.format
-            and buffer == other.buffer
-            and cum_rebuf == other.cum_rebuf;
+        return ssim_index() == other.ssim_index()
+            and delivery_rate() == other.delivery_rate()
+            and expt_id() == other.expt_id()
+            and init_id() == other.init_id()
+            and user_id() == other.user_id()
+            and size() == other.size()
+            and first_init_id() == other.first_init_id()
+            and video_ts() == other.video_ts()
+            and cwnd() == other.cwnd()
+            and in_flight() == other.in_flight()
+            and min_rtt() == other.min_rtt()
+            and rtt() == other.rtt()
+            and format() == other.format()
+            and buffer() == other.buffer()
+            and cum_rebuf() == other.cum_rebuf();
     }
 
     bool operator!=(const VideoSent & other) const { return not operator==(other); }
 
     template <typename T>
-        void set_unique( optional<T> & field, const T & value ) {
-            if (not field.has_value()) {
-                field.emplace(value);
+        void set_unique( const Field bit, T & field, const T & value ) {
+            if (not (present_ & bit)) {
+                field = value;
+                present_ |= bit;
             } else {
-                if (field.value() != value) {
+                if (field != value) {
                     if (not bad) {
                         bad = true;
-                        cerr << "error trying to set contradictory VideoSent value " << value <<
-                                "(old value " << field.value() << ")\n";
-                        cerr << "Contradictory VideoSent:\n";
-                        cerr << *this; 
+                        diagnostics().report("contradictory_video_sent", [&](ostream & out) {
+                            out << "error trying to set contradictory VideoSent value " << value <<
+                                   "(old value " << field << ")\n";
+                            out << "Contradictory VideoSent:\n";
+                            out << *this;
+                        });
                     }
                     // throw runtime_error( "contradictory values: " + to_string(field.value()) + " vs. " + to_string(value) );
                 }
@@ -445,68 +757,134 @@ struct VideoSent {
 
     void insert_unique(const string_view key, const string_view value,
             string_table & usernames, string_table & formats) {
-        if (key == "first_init_id"sv) {
-            set_unique( first_init_id, influx_integer<uint32_t>( value ) );
-        } else if (key == "init_id"sv) {
-            set_unique( init_id, influx_integer<uint32_t>( value ) );
-        } else if (key == "expt_id"sv) {
-            set_unique( expt_id, influx_integer<uint32_t>( value ) );
-        } else if (key == "user"sv) {
+        switch (to_field_key(key)) {
+        case FieldKey::first_init_id:
+            set_unique( FIRST_INIT_ID, first_init_id_, influx_integer<uint32_t>( value ) );
+            break;
+        case FieldKey::init_id:
+            set_unique( INIT_ID, init_id_, influx_integer<uint32_t>( value ) );
+            break;
+        case FieldKey::expt_id:
+            set_unique( EXPT_ID, expt_id_, influx_integer<uint32_t>( value ) );
+            break;
+        case FieldKey::user:
             if (value.size() <= 2 or value.front() != '"' or value.back() != '"') {
                 throw runtime_error("invalid username string: " + string(value));
             }
-            set_unique( user_id, usernames.forward_map_vivify(string(value.substr(1,value.size()-2))) );
-        } else if (key == "ssim_index"sv) {
-            set_unique( ssim_index, to_float(value) );
-        } else if (key == "delivery_rate"sv) {
-            set_unique( delivery_rate, influx_integer<uint32_t>( value ) );
-        } else if (key == "size"sv) {
-            set_unique( size, influx_integer<uint32_t>( value ) );
-        } else if (key == "video_ts"sv) {
-            set_unique( video_ts, influx_integer<uint64_t>( value ) );
-        } else if (key == "cwnd"sv) {
-            set_unique( cwnd, influx_integer<uint32_t>( value ) );
-        } else if (key == "in_flight"sv) {
-            set_unique( in_flight, influx_integer<uint32_t>( value ) );
-        } else if (key == "min_rtt"sv) {
-            set_unique( min_rtt, influx_integer<uint32_t>( value ) );
-        } else if (key == "rtt"sv) {
-            set_unique( rtt, influx_integer<uint32_t>( value ) );
-        } else if (key == "format"sv) {
-            set_unique( format, formats.forward_map_vivify(string(value.substr(1,value.size()-2))) );
-        } else if (key == "buffer"sv) {
-            set_unique( buffer, to_float(value) );
-        } else if (key == "cum_rebuffer"sv) {
-            set_unique( cum_rebuf, to_float(value) );
-        } else {
+            set_unique( USER_ID, user_id_, usernames.forward_map_vivify(value.substr(1,value.size()-2)) );
+            break;
+        case FieldKey::ssim_index:
+            set_unique( SSIM_INDEX, ssim_index_, to_float(value) );
+            break;
+        case FieldKey::delivery_rate:
+            set_unique( DELIVERY_RATE, delivery_rate_, influx_integer<uint32_t>( value ) );
+            break;
+        case FieldKey::size:
+            set_unique( SIZE, size_, influx_integer<uint32_t>( value ) );
+            break;
+        case FieldKey::video_ts:
+            set_unique( VIDEO_TS, video_ts_, influx_integer<uint64_t>( value ) );
+            break;
+        case FieldKey::cwnd:
+            set_unique( CWND, cwnd_, influx_integer<uint32_t>( value ) );
+            break;
+        case FieldKey::in_flight:
+            set_unique( IN_FLIGHT, in_flight_, influx_integer<uint32_t>( value ) );
+            break;
+        case FieldKey::min_rtt:
+            set_unique( MIN_RTT, min_rtt_, influx_integer<uint32_t>( value ) );
+            break;
+        case FieldKey::rtt:
+            set_unique( RTT, rtt_, influx_integer<uint32_t>( value ) );
+            break;
+        case FieldKey::format:
+            set_unique( FORMAT, format_, formats.forward_map_vivify(value.substr(1,value.size()-2)) );
+            break;
+        case FieldKey::buffer:
+            set_unique( BUFFER, buffer_, to_float(value) );
+            break;
+        case FieldKey::cum_rebuffer:
+            set_unique( CUM_REBUF, cum_rebuf_, to_float(value) );
+            break;
+        default:
             throw runtime_error( "unknown key: " + string(key) );
         }
     }
+
+    /* See Event::merge() */
+    void merge(const VideoSent & other) {
+        if (other.present_ & SSIM_INDEX) { set_unique( SSIM_INDEX, ssim_index_, other.ssim_index_ ); }
+        if (other.present_ & DELIVERY_RATE) { set_unique( DELIVERY_RATE, delivery_rate_, other.delivery_rate_ ); }
+        if (other.present_ & EXPT_ID) { set_unique( EXPT_ID, expt_id_, other.expt_id_ ); }
+        if (other.present_ & INIT_ID) { set_unique( INIT_ID, init_id_, other.init_id_ ); }
+        if (other.present_ & FIRST_INIT_ID) { set_unique( FIRST_INIT_ID, first_init_id_, other.first_init_id_ ); }
+        if (other.present_ & USER_ID) { set_unique( USER_ID, user_id_, other.user_id_ ); }
+        if (other.present_ & SIZE) { set_unique( SIZE, size_, other.size_ ); }
+        if (other.present_ & FORMAT) { set_unique( FORMAT, format_, other.format_ ); }
+        if (other.present_ & CWND) { set_unique( CWND, cwnd_, other.cwnd_ ); }
+        if (other.present_ & IN_FLIGHT) { set_unique( IN_FLIGHT, in_flight_, other.in_flight_ ); }
+        if (other.present_ & MIN_RTT) { set_unique( MIN_RTT, min_rtt_, other.min_rtt_ ); }
+        if (other.present_ & RTT) { set_unique( RTT, rtt_, other.rtt_ ); }
+        if (other.present_ & VIDEO_TS) { set_unique( VIDEO_TS, video_ts_, other.video_ts_ ); }
+        if (other.present_ & BUFFER) { set_unique( BUFFER, buffer_, other.buffer_ ); }
+        if (other.present_ & CUM_REBUF) { set_unique( CUM_REBUF, cum_rebuf_, other.cum_rebuf_ ); }
+        bad = bad or other.bad;
+    }
+
+    /* See Event::remap_user_id() */
+    void remap_user_id(const vector<uint32_t> & id_map) {
+        if (present_ & USER_ID) { user_id_ = id_map.at(user_id_); }
+    }
+    void remap_format(const vector<uint32_t> & id_map) {
+        if (present_ & FORMAT) { format_ = id_map.at(format_); }
+    }
+
     friend std::ostream& operator<<(std::ostream& out, const VideoSent& s); 
 };
 std::ostream& operator<< (std::ostream& out, const VideoSent& s) {        
-    return out << "init_id=" << s.init_id.value_or(-1)
-        << ", expt_id=" << s.expt_id.value_or(-1)
-        << ", user_id=" << s.user_id.value_or(-1)
-        << ", ssim_index=" << s.ssim_index.value_or(-1)
-        << ", delivery_rate=" << s.delivery_rate.value_or(-1)
-        << ", size=" << s.size.value_or(-1)
-        << ", first_init_id=" << s.first_init_id.value_or(-1)
-        << ", video_ts=" << s.video_ts.value_or(-1)
-        << ", cwnd=" << s.cwnd.value_or(-1)
-        << ", in_flight=" << s.in_flight.value_or(-1)
-        << ", min_rtt=" << s.min_rtt.value_or(-1)
-        << ", rtt=" << s.rtt.value_or(-1)
-        << ", format=" << s.format.value_or(-1)
-        << ", buffer=" << s.buffer.value_or(-1)
-        << ", cum_rebuf=" << s.cum_rebuf.value_or(-1)
+    return out << "init_id=" << s.init_id().value_or(-1)
+        << ", expt_id=" << s.expt_id().value_or(-1)
+        << ", user_id=" << s.user_id().value_or(-1)
+        << ", ssim_index=" << s.ssim_index().value_or(-1)
+        << ", delivery_rate=" << s.delivery_rate().value_or(-1)
+        << ", size=" << s.size().value_or(-1)
+        << ", first_init_id=" << s.first_init_id().value_or(-1)
+        << ", video_ts=" << s.video_ts().value_or(-1)
+        << ", cwnd=" << s.cwnd().value_or(-1)
+        << ", in_flight=" << s.in_flight().value_or(-1)
+        << ", min_rtt=" << s.min_rtt().value_or(-1)
+        << ", rtt=" << s.rtt().value_or(-1)
+        << ", format=" << s.format().value_or(-1)
+        << ", buffer=" << s.buffer().value_or(-1)
+        << ", cum_rebuf=" << s.cum_rebuf().value_or(-1)
         << "\n";
 }
 
 struct VideoAcked {
-    optional<uint32_t> expt_id{}, init_id{}, first_init_id{}, user_id{};
-    optional<uint64_t> video_ts{};
-    optional<float> buffer{}, cum_rebuf{};
+    /* Fields are stored packed, with one presence bit each in present_ (see Event) */
+    enum Field : uint8_t {
+        EXPT_ID = 1 << 0, INIT_ID = 1 << 1, FIRST_INIT_ID = 1 << 2, USER_ID = 1 << 3,
+        VIDEO_TS = 1 << 4, BUFFER = 1 << 5, CUM_REBUF = 1 << 6
+    };
+    // all fields but first_init_id
+    static constexpr uint8_t MANDATORY = EXPT_ID | INIT_ID | USER_ID | VIDEO_TS | BUFFER | CUM_REBUF;
+
+    private:
+    uint64_t video_ts_{};
+    uint32_t expt_id_{}, init_id_{}, first_init_id_{}, user_id_{};
+    float buffer_{}, cum_rebuf_{};
+    uint8_t present_ = 0;
+
+    public:
+    bool bad = false;
+
+    optional<uint32_t> expt_id() const { return packed_field(present_, EXPT_ID, expt_id_); }
+    optional<uint32_t> init_id() const { return packed_field(present_, INIT_ID, init_id_); }
+    optional<uint32_t> first_init_id() const { return packed_field(present_, FIRST_INIT_ID, first_init_id_); }
+    optional<uint32_t> user_id() const { return packed_field(present_, USER_ID, user_id_); }
+    optional<uint64_t> video_ts() const { return packed_field(present_, VIDEO_TS, video_ts_); }
+    optional<float> buffer() const { return packed_field(present_, BUFFER, buffer_); }
+    optional<float> cum_rebuf() const { return packed_field(present_, CUM_REBUF, cum_rebuf_); }
    
     // Comma-separated anonymous keys and values (to be dumped)
     static string anon_keys() { 
@@ -515,48 +893,48 @@ struct VideoAcked {
                VAR_NAME(cum_rebuf);
     }
     // Should only be called on complete datapoints
-    string anon_values() const { 
-        ostringstream values;
-        values << video_ts.value() << ","
-               << buffer.value() << ","
-               << cum_rebuf.value();
-        return values.str();
+    void write_anon_values(CSVWriter & values) const { 
+        values << video_ts_ << ","
+               << buffer_ << ","
+               << cum_rebuf_;
     }
     // Makes templatizing easier, and enforces that dump() calls the correct function
-    string anon_values(const string_table & formats __attribute((unused)) ) const { 
+    void write_anon_values(CSVWriter & values __attribute((unused)),
+                           const string_table & formats __attribute((unused)) ) const { 
         throw logic_error("VideoAcked does not use formats table to retrieve anonymous values");
     }
 
-    bool bad = false;
-
     bool complete() const {
-        return expt_id and init_id and user_id and video_ts and buffer and cum_rebuf;
+        return (present_ & MANDATORY) == MANDATORY;
     }
 
     bool operator==(const VideoAcked & other) const {
-        return expt_id == other.expt_id
-            and init_id == other.init_id
-            and user_id == other.user_id
-            and first_init_id == other.first_init_id
-            and video_ts == other.video_ts
-            and buffer == other.buffer
-            and cum_rebuf == other.cum_rebuf;
+        return expt_id() == other.expt_id()
+            and init_id() == other.init_id()
+            and user_id() == other.user_id()
+            and first_init_id() == other.first_init_id()
+            and video_ts() == other.video_ts()
+            and buffer() == other.buffer()
+            and cum_rebuf() == other.cum_rebuf();
     }
 
     bool operator!=(const VideoAcked & other) const { return not operator==(other); }
 
     template <typename T>
-        void set_unique( optional<T> & field, const T & value ) {
-            if (not field.has_value()) {
-                field.emplace(value);
+        void set_unique( const Field bit, T & field, const T & value ) {
+            if (not (present_ & bit)) {
+                field = value;
+                present_ |= bit;
             } else {
-                if (field.value() != value) {
+                if (field != value) {
                     if (not bad) {
                         bad = true;
-                        cerr << "error trying to set contradictory videoacked value " << value <<
-                                "(old value " << field.value() << ")\n";
-                        cerr << "Contradictory videoacked:\n";
-                        cerr << *this;
+                        diagnostics().report("contradictory_video_acked", [&](ostream & out) {
+                            out << "error trying to set contradictory videoacked value " << value <<
+                                   "(old value " << field << ")\n";
+                            out << "Contradictory videoacked:\n";
+                            out << *this;
+                        });
                     }
                     // throw runtime_error( "contradictory values: " + to_string(field.value()) + " vs. " + to_string(value) );
                 }
@@ -565,39 +943,66 @@ struct VideoAcked {
 
     void insert_unique(const string_view key, const string_view value,
             string_table & usernames) {
-        if (key == "first_init_id"sv) {
-            set_unique( first_init_id, influx_integer<uint32_t>( value ) );
-        } else if (key == "init_id"sv) {
-            set_unique( init_id, influx_integer<uint32_t>( value ) );
-        } else if (key == "expt_id"sv) {
-            set_unique( expt_id, influx_integer<uint32_t>( value ) );
-        } else if (key == "user"sv) {
+        switch (to_field_key(key)) {
+        case FieldKey::first_init_id:
+            set_unique( FIRST_INIT_ID, first_init_id_, influx_integer<uint32_t>( value ) );
+            break;
+        case FieldKey::init_id:
+            set_unique( INIT_ID, init_id_, influx_integer<uint32_t>( value ) );
+            break;
+        case FieldKey::expt_id:
+            set_unique( EXPT_ID, expt_id_, influx_integer<uint32_t>( value ) );
+            break;
+        case FieldKey::user:
             if (value.size() <= 2 or value.front() != '"' or value.back() != '"') {
                 throw runtime_error("invalid username string: " + string(value));
             }
-            set_unique( user_id, usernames.forward_map_vivify(string(value.substr(1,value.size()-2))) );
-        } else if (key == "video_ts"sv) {
-            set_unique( video_ts, influx_integer<uint64_t>( value ) );
-        } else if (key == "ssim_index"sv) {
+            set_unique( USER_ID, user_id_, usernames.forward_map_vivify(value.substr(1,value.size()-2)) );
+            break;
+        case FieldKey::video_ts:
+            set_unique( VIDEO_TS, video_ts_, influx_integer<uint64_t>( value ) );
+            break;
+        case FieldKey::ssim_index:
             // ignore (already recorded in corresponding video_sent)
-        } else if (key == "buffer"sv) {
-            set_unique( buffer, to_float(value) );
-        } else if (key == "cum_rebuffer"sv) {
-            set_unique( cum_rebuf, to_float(value) );
-        } else {
+            break;
+        case FieldKey::buffer:
+            set_unique( BUFFER, buffer_, to_float(value) );
+            break;
+        case FieldKey::cum_rebuffer:
+            set_unique( CUM_REBUF, cum_rebuf_, to_float(value) );
+            break;
+        default:
             throw runtime_error( "unknown key: " + string(key) );
         }
     }
+
+    /* See Event::merge() */
+    void merge(const VideoAcked & other) {
+        if (other.present_ & EXPT_ID) { set_unique( EXPT_ID, expt_id_, other.expt_id_ ); }
+        if (other.present_ & INIT_ID) { set_unique( INIT_ID, init_id_, other.init_id_ ); }
+        if (other.present_ & FIRST_INIT_ID) { set_unique( FIRST_INIT_ID, first_init_id_, other.first_init_id_ ); }
+        if (other.present_ & USER_ID) { set_unique( USER_ID, user_id_, other.user_id_ ); }
+        if (other.present_ & VIDEO_TS) { set_unique( VIDEO_TS, video_ts_, other.video_ts_ ); }
+        if (other.present_ & BUFFER) { set_unique( BUFFER, buffer_, other.buffer_ ); }
+        if (other.present_ & CUM_REBUF) { set_unique( CUM_REBUF, cum_rebuf_, other.cum_rebuf_ ); }
+        bad = bad or other.bad;
+    }
+
+    /* See Event::remap_user_id() */
+    void remap_user_id(const vector<uint32_t> & id_map) {
+        if (present_ & USER_ID) { user_id_ = id_map.at(user_id_); }
+    }
+
     friend std::ostream& operator<<(std::ostream& out, const VideoAcked& s); 
 };
 std::ostream& operator<< (std::ostream& out, const VideoAcked& s) {        
-    return out << "init_id=" << s.init_id.value_or(-1)
-        << ", expt_id=" << s.expt_id.value_or(-1)
-        << ", user_id=" << s.user_id.value_or(-1)
-        << ", first_init_id=" << s.first_init_id.value_or(-1)
-        << ", video_ts=" << s.video_ts.value_or(-1)
-        << ", buffer=" << s.buffer.value_or(-1)
-        << ", cum_rebuf=" << s.cum_rebuf.value_or(-1)
+    return out << "init_id=" << s.init_id().value_or(-1)
+        << ", expt_id=" << s.expt_id().value_or(-1)
+        << ", user_id=" << s.user_id().value_or(-1)
+        << ", first_init_id=" << s.first_init_id().value_or(-1)
+        << ", video_ts=" << s.video_ts().value_or(-1)
+        << ", buffer=" << s.buffer().value_or(-1)
+        << ", cum_rebuf=" << s.cum_rebuf().value_or(-1)
         << "\n";
 }
 
@@ -611,14 +1016,13 @@ struct VideoSize {
                VAR_NAME(size);
     }
     // Should only be called on complete datapoints
-    string anon_values() const { 
-        ostringstream values;
+    void write_anon_values(CSVWriter & values) const { 
         values << video_ts.value() << ","
                << size.value();
-        return values.str();
     }
     // Makes templatizing easier, and enforces that dump() calls the correct function
-    string anon_values(const string_table & formats __attribute((unused)) ) const { 
+    void write_anon_values(CSVWriter & values __attribute((unused)),
+                           const string_table & formats __attribute((unused)) ) const { 
         throw logic_error("VideoSize does not use formats table to retrieve anonymous values");
     }
 
@@ -643,10 +1047,12 @@ struct VideoSize {
                 if (field.value() != value) {
                     if (not bad) {
                         bad = true;
-                        cerr << "error trying to set contradictory VideoSent value " << value <<
-                                "(old value " << field.value() << ")\n";
-                        cerr << "Contradictory VideoSent:\n";
-                        cerr << *this; 
+                        diagnostics().report("contradictory_video_size", [&](ostream & out) {
+                            out << "error trying to set contradictory VideoSent value " << value <<
+                                   "(old value " << field.value() << ")\n";
+                            out << "Contradictory VideoSent:\n";
+                            out << *this;
+                        });
                     }
                     // throw runtime_error( "contradictory values: " + to_string(field.value()) + " vs. " + to_string(value) );
                 }
@@ -656,14 +1062,24 @@ struct VideoSize {
     void insert_unique(const string_view key, const string_view value) {
         /* For video_size and ssim measurements, presentation ts is called "timestamp"
          * (not "video_ts" as in video_sent) */
-        if (key == "timestamp"sv) {
+        switch (to_field_key(key)) {
+        case FieldKey::timestamp:
             set_unique( video_ts, influx_integer<uint64_t>( value ) );
-        } else if (key == "size"sv) {
+            break;
+        case FieldKey::size:
             set_unique( size, influx_integer<uint32_t>( value ) );
-        } else {
+            break;
+        default:
             throw runtime_error( "unknown key: " + string(key) );
         }
     }
+
+    /* See Event::merge() */
+    void merge(const VideoSize & other) {
+        if (other.video_ts) { set_unique( video_ts, *other.video_ts ); }
+        if (other.size) { set_unique( size, *other.size ); }
+        bad = bad or other.bad;
+    }
     friend std::ostream& operator<<(std::ostream& out, const VideoSize& s); 
 };
 std::ostream& operator<< (std::ostream& out, const VideoSize& s) {        
@@ -682,14 +1098,13 @@ struct SSIM {
                VAR_NAME(ssim_index);
     }
     // Should only be called on complete datapoints
-    string anon_values() const { 
-        ostringstream values;
+    void write_anon_values(CSVWriter & values) const { 
         values << video_ts.value() << ","
                << ssim_index.value();
-        return values.str();
     }
     // Makes templatizing easier, and enforces that dump() calls the correct function
-    string anon_values(const string_table & formats __attribute((unused)) ) const { 
+    void write_anon_values(CSVWriter & values __attribute((unused)),
+                           const string_table & formats __attribute((unused)) ) const { 
         throw logic_error("SSIM does not use formats table to retrieve anonymous values");
     }
 
@@ -714,10 +1129,12 @@ struct SSIM {
                 if (field.value() != value) {
                     if (not bad) {
                         bad = true;
-                        cerr << "error trying to set contradictory SSIM value " << value <<
-                                "(old value " << field.value() << ")\n";
-                        cerr << "Contradictory SSIM:\n";
-                        cerr << *this; 
+                        diagnostics().report("contradictory_ssim", [&](ostream & out) {
+                            out << "error trying to set contradictory SSIM value " << value <<
+                                   "(old value " << field.value() << ")\n";
+                            out << "Contradictory SSIM:\n";
+                            out << *this;
+                        });
                     }
                     // throw runtime_error( "contradictory values: " + to_string(field.value()) + " vs. " + to_string(value) );
                 }
@@ -727,14 +1144,24 @@ struct SSIM {
     void insert_unique(const string_view key, const string_view value) {
         /* For video_size and ssim measurements, presentation ts is called "timestamp"
          * (not "video_ts" as in video_sent) */
-        if (key == "timestamp"sv) {
+        switch (to_field_key(key)) {
+        case FieldKey::timestamp:
             set_unique( video_ts, influx_integer<uint64_t>( value ) );
-        } else if (key == "ssim_index"sv) {
+            break;
+        case FieldKey::ssim_index:
             set_unique( ssim_index, to_float(value) );
-        } else {
+            break;
+        default:
             throw runtime_error( "unknown key: " + string(key) );
         }
     }
+
+    /* See Event::merge() */
+    void merge(const SSIM & other) {
+        if (other.video_ts) { set_unique( video_ts, *other.video_ts ); }
+        if (other.ssim_index) { set_unique( ssim_index, *other.ssim_index ); }
+        bad = bad or other.bad;
+    }
     friend std::ostream& operator<<(std::ostream& out, const SSIM& s); 
 };
 std::ostream& operator<< (std::ostream& out, const SSIM& s) {        
@@ -0,0 +1,443 @@
+/* Columnar binary tables, for passing rows between pipeline stages without reparsing text */
+
+#ifndef COLUMNUTIL_HH
+#define COLUMNUTIL_HH
+
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <limits>
+#include <cstdint>
+#include <cstring>
+#include <google/dense_hash_map>
+
+#include "mmaputil.hh"
+
+/* File layout (integers little-endian, as written by x86):
+ *   COLUMNAR_MAGIC
+ *   blocks of up to COLUMNAR_BLOCK_ROWS rows of one column each, encoded by column type:
+ *     timestamp, uint64: first value, then zigzag deltas from the previous value, as varints
+ *     float64: raw 8-byte doubles (fixed width)
+ *     string: varint codes into the column's dictionary
+ *   footer:
+ *     u64 n_rows, u64 min_ts, u64 max_ts (over the timestamp column, if any; else 0, 0)
+ *     u32 n_columns, then per column:
+ *       u8 type, u16 name length, name,
+ *       u32 n_blocks, then per block: u64 offset, u64 size, u32 n_rows
+ *       if string: u32 n_entries, then per entry: u16 length, bytes
+ *   u64 footer offset
+ *   COLUMNAR_MAGIC */
+static constexpr std::string_view COLUMNAR_MAGIC = "PUFCOL1\n";
+static constexpr size_t COLUMNAR_BLOCK_ROWS = 1 << 16;
+
+enum class ColumnType : uint8_t { timestamp, uint64, float64, string };
+
+struct ColumnSpec {
+    std::string name;
+    ColumnType type;
+};
+
+/* Byte-level encoding shared by reader and writer */
+namespace columnar {
+    template <typename T>
+    void put(std::string & out, const T value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        out.append(reinterpret_cast<const char *>(&value), sizeof value);
+    }
+
+    void put_varint(std::string & out, uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back(char(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(char(value));
+    }
+
+    uint64_t zigzag(const uint64_t delta) {
+        return (delta << 1) ^ -(delta >> 63);
+    }
+
+    uint64_t unzigzag(const uint64_t encoded) {
+        return (encoded >> 1) ^ -(encoded & 1);
+    }
+
+    /* Reads from a bounded region of a file; any read past its end means the file is corrupt */
+    class Cursor {
+        std::string_view rest_;
+        const std::string * filename_;
+
+        void need(const size_t len) const {
+            if (rest_.size() < len) {
+                throw std::runtime_error("truncated or corrupt columnar file: " + *filename_);
+            }
+        }
+
+        public:
+        Cursor(const std::string_view region, const std::string & filename)
+            : rest_(region), filename_(&filename) {}
+
+        Cursor(const Cursor &) = default;
+        Cursor & operator=(const Cursor &) = default;
+
+        template <typename T>
+        T get() {
+            need(sizeof(T));
+            T value;
+            memcpy(&value, rest_.data(), sizeof value);
+            rest_.remove_prefix(sizeof value);
+            return value;
+        }
+
+        std::string_view get_bytes(const size_t len) {
+            need(len);
+            const std::string_view bytes = rest_.substr(0, len);
+            rest_.remove_prefix(len);
+            return bytes;
+        }
+
+        uint64_t get_varint() {
+            uint64_t value = 0;
+            for (unsigned shift = 0; shift < 64; shift += 7) {
+                need(1);
+                const uint8_t byte = rest_.front();
+                rest_.remove_prefix(1);
+                value |= uint64_t(byte & 0x7f) << shift;
+                if (not (byte & 0x80)) {
+                    return value;
+                }
+            }
+            throw std::runtime_error("corrupt varint in columnar file: " + *filename_);
+        }
+    };
+}
+
+/* Writes a table one row at a time: set each column of the row with append(), then end_row().
+ * Each column is flushed to the file a block at a time; the footer is written by close(). */
+class ColumnarWriter {
+    struct Column {
+        ColumnSpec spec;
+        std::vector<uint64_t> integers{};       // timestamp, uint64, and string (dictionary codes)
+        std::vector<double> floats{};
+        std::vector<std::string> dictionary{};
+        google::dense_hash_map<std::string, uint32_t> codes{};
+        std::string blocks_meta{};               // per block: offset, size, n_rows
+        uint32_t n_blocks = 0;
+        bool set_in_row = false;
+
+        explicit Column(ColumnSpec column_spec) : spec(std::move(column_spec)) {
+            codes.set_empty_key(std::string(1, '\0'));   // strings with NUL can't be stored
+        }
+    };
+
+    std::string filename_;
+    std::ofstream file_;
+    uint64_t offset_ = 0;
+    std::vector<Column> columns_{};
+    uint64_t n_rows_ = 0;
+    uint64_t min_ts_ = std::numeric_limits<uint64_t>::max(), max_ts_ = 0;
+    std::string encoded_{};
+
+    void write(const std::string_view bytes) {
+        file_.write(bytes.data(), bytes.size());
+        offset_ += bytes.size();
+    }
+
+    Column & column(const size_t index, const bool is_float, const bool is_string) {
+        Column & col = columns_.at(index);
+        if ((col.spec.type == ColumnType::float64) != is_float
+                or (col.spec.type == ColumnType::string) != is_string) {
+            throw std::logic_error("wrong type of value for column " + col.spec.name);
+        }
+        if (col.set_in_row) {
+            throw std::logic_error("column " + col.spec.name + " set twice in one row");
+        }
+        col.set_in_row = true;
+        return col;
+    }
+
+    void flush_block(Column & col) {
+        encoded_.clear();
+        size_t n_block_rows;
+        if (col.spec.type == ColumnType::float64) {
+            n_block_rows = col.floats.size();
+            encoded_.append(reinterpret_cast<const char *>(col.floats.data()), col.floats.size() * sizeof(double));
+            col.floats.clear();
+        } else {
+            n_block_rows = col.integers.size();
+            uint64_t previous = 0;
+            for (const uint64_t value : col.integers) {
+                if (col.spec.type == ColumnType::string) {
+                    columnar::put_varint(encoded_, value);
+                } else {
+                    columnar::put_varint(encoded_, columnar::zigzag(value - previous));
+                    previous = value;
+                }
+            }
+            col.integers.clear();
+        }
+        if (n_block_rows == 0) {
+            return;
+        }
+
+        columnar::put<uint64_t>(col.blocks_meta, offset_);
+        columnar::put<uint64_t>(col.blocks_meta, encoded_.size());
+        columnar::put<uint32_t>(col.blocks_meta, n_block_rows);
+        col.n_blocks++;
+        write(encoded_);
+    }
+
+    public:
+    ColumnarWriter(const std::string & filename, const std::vector<ColumnSpec> & columns)
+        : filename_(filename), file_(filename, std::ios::binary)
+    {
+        if (not file_.is_open()) {
+            throw std::runtime_error("can't open " + filename);
+        }
+        for (const ColumnSpec & spec : columns) {
+            columns_.emplace_back(spec);
+        }
+        write(COLUMNAR_MAGIC);
+    }
+
+    void append(const size_t index, const uint64_t value) {
+        Column & col = column(index, false, false);
+        col.integers.push_back(value);
+        if (col.spec.type == ColumnType::timestamp) {
+            min_ts_ = std::min(min_ts_, value);
+            max_ts_ = std::max(max_ts_, value);
+        }
+    }
+
+    void append(const size_t index, const double value) {
+        column(index, true, false).floats.push_back(value);
+    }
+
+    void append(const size_t index, const std::string_view value) {
+        Column & col = column(index, false, true);
+        if (value.size() > std::numeric_limits<uint16_t>::max() or value.find('\0') != value.npos) {
+            throw std::runtime_error("can't store string in column " + col.spec.name);
+        }
+        const auto [it, inserted] = col.codes.insert({std::string(value), col.dictionary.size()});
+        if (inserted) {
+            col.dictionary.emplace_back(value);
+        }
+        col.integers.push_back(it->second);
+    }
+
+    void end_row() {
+        for (Column & col : columns_) {
+            if (not col.set_in_row) {
+                throw std::logic_error("column " + col.spec.name + " not set in row " + std::to_string(n_rows_));
+            }
+            col.set_in_row = false;
+            if (col.integers.size() + col.floats.size() == COLUMNAR_BLOCK_ROWS) {
+                flush_block(col);
+            }
+        }
+        n_rows_++;
+    }
+
+    /* Bytes written to the file so far; all of them after close() */
+    uint64_t bytes_written() const { return offset_; }
+
+    /* Flush remaining rows, write footer, and close; throws if any write failed */
+    void close() {
+        for (Column & col : columns_) {
+            flush_block(col);
+        }
+
+        const uint64_t footer_offset = offset_;
+        std::string footer;
+        const bool any_ts = min_ts_ <= max_ts_;
+        columnar::put<uint64_t>(footer, n_rows_);
+        columnar::put<uint64_t>(footer, any_ts ? min_ts_ : 0);
+        columnar::put<uint64_t>(footer, any_ts ? max_ts_ : 0);
+        columnar::put<uint32_t>(footer, columns_.size());
+        for (const Column & col : columns_) {
+            columnar::put<uint8_t>(footer, uint8_t(col.spec.type));
+            columnar::put<uint16_t>(footer, col.spec.name.size());
+            footer += col.spec.name;
+            columnar::put<uint32_t>(footer, col.n_blocks);
+            footer += col.blocks_meta;
+            if (col.spec.type == ColumnType::string) {
+                columnar::put<uint32_t>(footer, col.dictionary.size());
+                for (const std::string & entry : col.dictionary) {
+                    columnar::put<uint16_t>(footer, entry.size());
+                    footer += entry;
+                }
+            }
+        }
+        columnar::put<uint64_t>(footer, footer_offset);
+        footer += COLUMNAR_MAGIC;
+        write(footer);
+
+        file_.close();
+        if (file_.bad()) {
+            throw std::runtime_error("error writing " + filename_);
+        }
+    }
+};
+
+/* Reads a columnar table through mmap. Only the requested columns are decoded
+ * (and so only their blocks are paged in). Strings point into the mapping. */
+class ColumnarReader {
+    struct Block {
+        uint64_t offset, size;
+        uint32_t n_rows;
+    };
+    struct Column {
+        ColumnSpec spec;
+        std::vector<Block> blocks{};
+        std::vector<std::string_view> dictionary{};
+    };
+
+    MappedFile file_;
+    uint64_t n_rows_ = 0, min_ts_ = 0, max_ts_ = 0;
+    std::vector<Column> columns_{};
+
+    const Column & find_column(const std::string_view name, const ColumnType type) const {
+        for (const Column & col : columns_) {
+            if (col.spec.name == name) {
+                if (col.spec.type != type) {
+                    throw std::runtime_error("column " + std::string(name) + " has unexpected type in "
+                                             + file_.filename());
+                }
+                return col;
+            }
+        }
+        throw std::runtime_error("no column " + std::string(name) + " in " + file_.filename());
+    }
+
+    columnar::Cursor block_cursor(const Block & block) const {
+        const std::string_view contents = file_.contents();
+        if (block.offset > contents.size() or block.size > contents.size() - block.offset) {
+            throw std::runtime_error("block out of bounds in columnar file: " + file_.filename());
+        }
+        return {contents.substr(block.offset, block.size), file_.filename()};
+    }
+
+    /* Decode a timestamp/uint64/string column's integers (string: dictionary codes) */
+    std::vector<uint64_t> integers(const Column & col) const {
+        std::vector<uint64_t> values;
+        values.reserve(n_rows_);
+        for (const Block & block : col.blocks) {
+            columnar::Cursor cursor = block_cursor(block);
+            uint64_t previous = 0;
+            for (uint32_t i = 0; i < block.n_rows; i++) {
+                const uint64_t encoded = cursor.get_varint();
+                if (col.spec.type == ColumnType::string) {
+                    values.push_back(encoded);
+                } else {
+                    previous += columnar::unzigzag(encoded);
+                    values.push_back(previous);
+                }
+            }
+        }
+        return values;
+    }
+
+    public:
+    explicit ColumnarReader(const std::string & filename) : file_(filename) {
+        const std::string_view contents = file_.contents();
+        const size_t trailer_size = sizeof(uint64_t) + COLUMNAR_MAGIC.size();
+        if (contents.size() < COLUMNAR_MAGIC.size() + trailer_size
+                or contents.substr(0, COLUMNAR_MAGIC.size()) != COLUMNAR_MAGIC
+                or contents.substr(contents.size() - COLUMNAR_MAGIC.size()) != COLUMNAR_MAGIC) {
+            throw std::runtime_error("not a columnar file: " + filename);
+        }
+
+        columnar::Cursor trailer{contents.substr(contents.size() - trailer_size), filename};
+        const uint64_t footer_offset = trailer.get<uint64_t>();
+        if (footer_offset > contents.size() - trailer_size) {
+            throw std::runtime_error("footer out of bounds in columnar file: " + filename);
+        }
+        columnar::Cursor footer{contents.substr(footer_offset, contents.size() - trailer_size - footer_offset),
+                                filename};
+
+        n_rows_ = footer.get<uint64_t>();
+        min_ts_ = footer.get<uint64_t>();
+        max_ts_ = footer.get<uint64_t>();
+        const uint32_t n_columns = footer.get<uint32_t>();
+        for (uint32_t c = 0; c < n_columns; c++) {
+            Column col{};
+            const uint8_t type = footer.get<uint8_t>();
+            if (type > uint8_t(ColumnType::string)) {
+                throw std::runtime_error("unknown column type in columnar file: " + filename);
+            }
+            col.spec.type = ColumnType(type);
+            col.spec.name = footer.get_bytes(footer.get<uint16_t>());
+
+            const uint32_t n_blocks = footer.get<uint32_t>();
+            uint64_t column_rows = 0;
+            for (uint32_t b = 0; b < n_blocks; b++) {
+                const uint64_t offset = footer.get<uint64_t>();
+                const uint64_t size = footer.get<uint64_t>();
+                const uint32_t n_block_rows = footer.get<uint32_t>();
+                col.blocks.push_back({offset, size, n_block_rows});
+                column_rows += n_block_rows;
+            }
+            if (column_rows != n_rows_) {
+                throw std::runtime_error("column " + col.spec.name + " has " + std::to_string(column_rows)
+                                         + " rows, expected " + std::to_string(n_rows_) + " in " + filename);
+            }
+            if (col.spec.type == ColumnType::float64) {
+                for (const Block & block : col.blocks) {
+                    if (block.size != block.n_rows * sizeof(double)) {
+                        throw std::runtime_error("float64 block has wrong size in columnar file: " + filename);
+                    }
+                }
+            }
+            if (col.spec.type == ColumnType::string) {
+                const uint32_t n_entries = footer.get<uint32_t>();
+                for (uint32_t e = 0; e < n_entries; e++) {
+                    col.dictionary.push_back(footer.get_bytes(footer.get<uint16_t>()));
+                }
+            }
+            columns_.push_back(std::move(col));
+        }
+    }
+
+    uint64_t n_rows() const { return n_rows_; }
+    // bytes in the file
+    uint64_t size() const { return file_.contents().size(); }
+    // range of the timestamp column (0, 0 if none)
+    uint64_t min_ts() const { return min_ts_; }
+    uint64_t max_ts() const { return max_ts_; }
+
+    std::vector<uint64_t> timestamps(const std::string_view name) const {
+        return integers(find_column(name, ColumnType::timestamp));
+    }
+
+    std::vector<uint64_t> uint64s(const std::string_view name) const {
+        return integers(find_column(name, ColumnType::uint64));
+    }
+
+    std::vector<double> float64s(const std::string_view name) const {
+        const Column & col = find_column(name, ColumnType::float64);
+        std::vector<double> values(n_rows_);
+        size_t row = 0;
+        for (const Block & block : col.blocks) {
+            memcpy(values.data() + row, block_cursor(block).get_bytes(block.size).data(), block.size);
+            row += block.n_rows;
+        }
+        return values;
+    }
+
+    std::vector<std::string_view> strings(const std::string_view name) const {
+        const Column & col = find_column(name, ColumnType::string);
+        std::vector<std::string_view> values;
+        values.reserve(n_rows_);
+        for (const uint64_t code : integers(col)) {
+            if (code >= col.dictionary.size()) {
+                throw std::runtime_error("dictionary code out of range in columnar file: " + file_.filename());
+            }
+            values.push_back(col.dictionary[code]);
+        }
+        return values;
+    }
+};
+
+#endif
@@ -0,0 +1,100 @@
+/* Diagnostics about anomalous records: counted per category, with a bounded sample of messages,
+ * summarized as JSON at exit (or, if verbose, each message printed as it occurs) */
+
+#ifndef DIAGUTIL_HH
+#define DIAGUTIL_HH
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <iostream>
+#include <cstdint>
+#include <jsoncpp/json/json.h>
+
+// Messages kept per category (the rest are only counted)
+static constexpr size_t MAX_DIAGNOSTIC_SAMPLES = 5;
+
+class Diagnostics {
+    struct Category {
+        uint64_t count = 0;
+        std::vector<std::string> samples{};
+    };
+
+    mutable std::mutex mutex_{};
+    std::map<std::string, Category, std::less<>> categories_{};
+    bool verbose_ = false;
+    // Suppression guards alive on this thread
+    static inline thread_local unsigned suppressions_ = 0;
+
+    public:
+    /* Print every message to stderr as it is reported, rather than only a sample in the summary */
+    void set_verbose(const bool verbose) { verbose_ = verbose; }
+    bool verbose() const { return verbose_; }
+
+    /* While one is alive, reports made on its thread are ignored (e.g. while re-reading records
+     * already reported once); reports from other threads are still counted */
+    class Suppression {
+        public:
+        Suppression() { suppressions_++; }
+        ~Suppression() { suppressions_--; }
+        Suppression(const Suppression &) = delete;
+        Suppression & operator=(const Suppression &) = delete;
+    };
+
+    /* Count one anomalous record in category. write_message(ostream &) describes it,
+     * and is only called if the message is printed or kept as a sample. Thread-safe. */
+    template <typename MessageFn>
+    void report(const std::string_view category_name, MessageFn write_message) {
+        if (suppressions_ > 0) {
+            return;
+        }
+        const std::lock_guard<std::mutex> lock{mutex_};
+        auto category = categories_.find(category_name);
+        if (category == categories_.end()) {
+            category = categories_.emplace(std::string(category_name), Category{}).first;
+        }
+        category->second.count++;
+
+        if (verbose_) {
+            write_message(std::cerr);
+        } else if (category->second.samples.size() < MAX_DIAGNOSTIC_SAMPLES) {
+            std::ostringstream message;
+            write_message(message);
+            category->second.samples.emplace_back(message.str());
+        }
+    }
+
+    /* Write one line of JSON: {"program": ..., "diagnostics": {category: {"count": n, "samples": [...]}}}
+     * (samples are omitted if verbose, since every message was already printed) */
+    void write_summary(std::ostream & out, const std::string & program) const {
+        const std::lock_guard<std::mutex> lock{mutex_};
+        Json::Value summary{Json::objectValue};
+        summary["program"] = program;
+        summary["diagnostics"] = Json::Value{Json::objectValue};
+        for (const auto & [name, category] : categories_) {
+            Json::Value & entry = summary["diagnostics"][name];
+            entry["count"] = Json::UInt64(category.count);
+            if (not verbose_) {
+                entry["samples"] = Json::Value{Json::arrayValue};
+                for (const auto & sample : category.samples) {
+                    entry["samples"].append(sample);
+                }
+            }
+        }
+
+        Json::StreamWriterBuilder writer;
+        writer["indentation"] = "";
+        out << Json::writeString(writer, summary) << "\n";
+    }
+};
+
+/* Diagnostics shared by the whole program */
+Diagnostics & diagnostics() {
+    static Diagnostics program_diagnostics;
+    return program_diagnostics;
+}
+
+#endif
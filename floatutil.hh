@@ -0,0 +1,120 @@
+/* Locale-free floating-point parsing shared by all tools */
+
+#ifndef FLOATUTIL_HH
+#define FLOATUTIL_HH
+
+#include <charconv>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <cstdint>
+#include <cstring>
+
+/* Powers of ten that are exact in a double; with a mantissa below 2^53, m * 10^e (or m / 10^-e)
+ * is then correctly rounded with one double operation (Clinger's fast path) */
+static constexpr double EXACT_POWERS_OF_TEN[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+static constexpr uint64_t MAX_FAST_PATH_MANTISSA = uint64_t(1) << 53;
+static constexpr int MAX_FAST_PATH_EXPONENT = 22;
+
+/* Parse all of str as a decimal number into value, without copying or writing to str.
+ * Returns false if str is not entirely a number (or is out of range for T).
+ * Accepts what from_chars() does: optional '-', digits with optional '.', optional exponent,
+ * inf/nan. Results are correctly rounded, independent of locale.
+ * Short decimals (the usual case, e.g. buffer=14.204) are converted exactly on the fast path;
+ * anything else (many digits, large exponents, inf/nan) falls back to from_chars()
+ * (in libstdc++ 12+, the Eisel-Lemire algorithm, also exact). */
+template <typename T>
+bool parse_floating(const std::string_view str, T & value) {
+    static_assert(std::is_same_v<T, float> or std::is_same_v<T, double>);
+
+    const char * p = str.data();
+    const char * const end = str.data() + str.size();
+
+    const bool negative = p != end and *p == '-';
+    if (negative) {
+        p++;
+    }
+
+    uint64_t mantissa = 0;
+    int n_digits = 0;           // significant digits in mantissa (after leading zeros)
+    int exponent = 0;           // of 10, applied to mantissa
+    bool any_digits = false;
+    bool exponent_digits = true;    // false if exponent marker has no digits (e.g. "1e")
+
+    for (; p != end and unsigned(*p - '0') < 10; p++) {
+        mantissa = mantissa * 10 + (*p - '0');
+        n_digits += mantissa != 0;
+        any_digits = true;
+    }
+    if (p != end and *p == '.') {
+        p++;
+        for (; p != end and unsigned(*p - '0') < 10; p++) {
+            mantissa = mantissa * 10 + (*p - '0');
+            n_digits += mantissa != 0;
+            exponent--;
+            any_digits = true;
+        }
+    }
+    if (any_digits and p != end and (*p == 'e' or *p == 'E')) {
+        p++;
+        const bool negative_exponent = p != end and *p == '-';
+        if (p != end and (*p == '-' or *p == '+')) {
+            p++;
+        }
+        int explicit_exponent = 0;
+        const char * const exponent_start = p;
+        for (; p != end and unsigned(*p - '0') < 10 and explicit_exponent < 10000; p++) {
+            explicit_exponent = explicit_exponent * 10 + (*p - '0');
+        }
+        exponent_digits = p != exponent_start;
+        exponent += negative_exponent ? -explicit_exponent : explicit_exponent;
+    }
+
+    if (p == end and any_digits and exponent_digits 
+            and n_digits <= 19 and mantissa <= MAX_FAST_PATH_MANTISSA
+            and exponent >= -MAX_FAST_PATH_EXPONENT and exponent <= MAX_FAST_PATH_EXPONENT) {
+        double ret = exponent < 0 ? double(mantissa) / EXACT_POWERS_OF_TEN[-exponent]
+                                  : double(mantissa) * EXACT_POWERS_OF_TEN[exponent];
+        if (negative) {
+            ret = -ret;
+        }
+        if constexpr (std::is_same_v<T, double>) {
+            value = ret;
+            return true;
+        } else {
+            /* ret is correctly rounded, so rounding it to float is too -- unless ret lies
+             * exactly halfway between two floats (its low 29 mantissa bits are 0b1000...) */
+            uint64_t bits;
+            memcpy(&bits, &ret, sizeof bits);
+            if ((bits & ((uint64_t(1) << 29) - 1)) != uint64_t(1) << 28) {
+                value = ret;
+                return true;
+            }
+        }
+    }
+
+    const auto [ptr, ec] = std::from_chars(str.data(), end, value);
+    return ec == std::errc() and ptr == end;
+}
+
+float to_float(const std::string_view str) {
+    float ret;
+    if (not parse_floating(str, ret)) {
+        throw std::runtime_error("could not parse as float: " + std::string(str));
+    }
+    return ret;
+}
+
+double to_double(const std::string_view str) {
+    double ret;
+    if (not parse_floating(str, ret)) {
+        throw std::runtime_error("could not parse as double: " + std::string(str));
+    }
+    return ret;
+}
+
+#endif
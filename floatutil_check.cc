@@ -0,0 +1,207 @@
+/* Check of parse_floating() (floatutil.hh): on random and edge-case strings, it must accept exactly
+ * what from_chars() does, and produce the same (correctly rounded) value as from_chars() and strtod()/strtof().
+ * Exits nonzero on any mismatch. */
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <random>
+#include <limits>
+#include <type_traits>
+#include <charconv>
+#include "floatutil.hh"
+
+using namespace std;
+
+// Mismatches printed, at most (the rest are only counted)
+static constexpr unsigned MAX_PRINTED = 10;
+
+template <typename T>
+using Bits = conditional_t<is_same_v<T, double>, uint64_t, uint32_t>;
+
+template <typename T>
+Bits<T> to_bits(const T value) {
+    Bits<T> bits;
+    memcpy(&bits, &value, sizeof bits);
+    return bits;
+}
+
+/* Random normal (not zero, subnormal, inf or nan) T of either sign: -Ofast flushes subnormals to zero,
+ * so those are only checked as fixed strings */
+template <typename T>
+T random_normal(mt19937_64 & rng) {
+    constexpr int mantissa_bits = numeric_limits<T>::digits - 1;
+    constexpr Bits<T> max_exponent = (Bits<T>(1) << (sizeof(T) * 8 - 1 - mantissa_bits)) - 2;
+    const Bits<T> bits = Bits<T>(rng() % 2) << (sizeof(T) * 8 - 1)
+                         | (rng() % max_exponent + 1) << mantissa_bits
+                         | (rng() & ((Bits<T>(1) << mantissa_bits) - 1));
+    T value;
+    memcpy(&value, &bits, sizeof value);
+    return value;
+}
+
+class FloatChecker {
+    uint64_t n_checked_ = 0, n_rejected_ = 0, n_mismatches_ = 0;
+
+    /* From the bits (a nan's magnitude exceeds inf's), since isnan() may be folded to false with -Ofast */
+    template <typename T>
+    static bool is_nan(const T value) {
+        const Bits<T> magnitude_mask = ~Bits<T>(0) >> 1;
+        return (to_bits(value) & magnitude_mask) > to_bits(numeric_limits<T>::infinity());
+    }
+
+    /* Bitwise equal (so -0 != 0), or both nan */
+    template <typename T>
+    static bool same(const T a, const T b) {
+        return (is_nan(a) and is_nan(b)) or memcmp(&a, &b, sizeof a) == 0;
+    }
+
+    void mismatch(const string & type, const string & str, const string & what) {
+        if (n_mismatches_++ < MAX_PRINTED) {
+            cerr << type << " \"" << str << "\": " << what << "\n";
+        }
+    }
+
+    /* strtod() or strtof() of all of str, or false if it doesn't take all of str or is out of range */
+    template <typename T>
+    static bool strto(const string & str, T & value) {
+        errno = 0;
+        char * end;
+        if constexpr (is_same_v<T, double>) {
+            value = strtod(str.c_str(), &end);
+        } else {
+            value = strtof(str.c_str(), &end);
+        }
+        return not str.empty() and *end == '\0' and errno != ERANGE;
+    }
+
+    template <typename T>
+    void check_type(const string & str, const string & type) {
+        T value{}, from_chars_value{}, strto_value{};
+        const bool ok = parse_floating(string_view(str), value);
+        const auto [ptr, ec] = from_chars(str.data(), str.data() + str.size(), from_chars_value);
+        const bool from_chars_ok = ec == errc() and ptr == str.data() + str.size();
+
+        if (ok != from_chars_ok) {
+            mismatch(type, str, ok ? "accepted, but from_chars() rejects" : "rejected, but from_chars() accepts");
+            return;
+        }
+        if (not ok) {
+            return;
+        }
+        if (not same(value, from_chars_value)) {
+            mismatch(type, str, "differs from from_chars()");
+        }
+        // strtod() also accepts e.g. leading '+' or whitespace, so only compare where from_chars() accepts
+        if (strto(str, strto_value) and not same(value, strto_value)) {
+            mismatch(type, str, "differs from strtod()/strtof()");
+        }
+    }
+
+    public:
+    void check(const string & str) {
+        n_checked_++;
+        check_type<double>(str, "double");
+        check_type<float>(str, "float");
+        double ignore;
+        n_rejected_ += not parse_floating(string_view(str), ignore);
+    }
+
+    /* str, printed from (a finite) value, must parse back to exactly value */
+    template <typename T>
+    void check_round_trip(const string & str, const T value) {
+        check(str);
+        T parsed;
+        if (not parse_floating(string_view(str), parsed) or not same(parsed, value)) {
+            mismatch(is_same_v<T, double> ? "double" : "float", str, "doesn't round-trip");
+        }
+    }
+
+    bool passed() const { return n_mismatches_ == 0; }
+
+    void print_summary() const {
+        cerr << n_checked_ << " strings checked (" << n_rejected_ << " rejected as doubles), "
+             << n_mismatches_ << " mismatches\n";
+    }
+};
+
+string printf_string(const char * format, const int precision, const double value) {
+    char buffer[64];
+    snprintf(buffer, sizeof buffer, format, precision, value);
+    return buffer;
+}
+
+void floatutil_check() {
+    FloatChecker checker;
+    mt19937_64 rng(1);
+
+    // edge cases: special values, empty or partial numbers, out of range, many digits, fast path limits
+    for (const string str : {"", "-", ".", "-.", "e5", ".e5", "1e", "1e+", "1e-", "+1", " 1", "1 ", "0x10",
+                             "nan", "-nan", "inf", "-inf", "infinity", "0", "-0", ".5", "5.", "-.5e1",
+                             "1e-400", "1e400", "1e-45", "1e-46", "3.4028235e38", "3.4028236e38",
+                             "00000000000000000000001.5", "123456789012345678901234", "0.1", "1.5e-5",
+                             "9007199254740992", "9007199254740993", "9007199254740994", "1e22", "1e23",
+                             "1e-22", "1e-23", "4.9406564584124654e-324", "1.7976931348623157e308"}) {
+        checker.check(str);
+    }
+
+    // integers and halves around 2^24, where floats can't represent every integer (ties round to even)
+    for (uint64_t k = (1 << 24) - 1000; k < (1 << 24) + 100000; k++) {
+        checker.check(to_string(k));
+        checker.check(to_string(k) + ".5");
+    }
+
+    // short decimals, like the values recorded (e.g. buffer=14.204)
+    for (unsigned i = 0; i < 500000; i++) {
+        const double value = (rng() % 100000000) / pow(10, rng() % 10);
+        checker.check(printf_string("%.*f", rng() % 8, value));
+        checker.check(printf_string("%.*f", rng() % 8, -value));
+    }
+
+    // random doubles and floats, printed with random or round-trip precision
+    for (unsigned i = 0; i < 500000; i++) {
+        const double double_value = random_normal<double>(rng);
+        checker.check(printf_string("%.*g", rng() % 17 + 1, double_value));
+        checker.check_round_trip(printf_string("%.*g", 17, double_value), double_value);
+
+        const float float_value = random_normal<float>(rng);
+        checker.check_round_trip(printf_string("%.*g", 9, float_value), float_value);
+    }
+
+    // near midpoints of adjacent floats, where rounding a double to float may round twice
+    for (unsigned i = 0; i < 500000; i++) {
+        const float below = random_normal<float>(rng);
+        const float above = nextafter(below, below * 2);
+        const double midpoint = (double(below) + double(above)) / 2;
+        checker.check(printf_string("%.*g", rng() % 3 + 15, midpoint));
+    }
+
+    // garbage made of number characters
+    const string alphabet = "0123456789.-+eE";
+    for (unsigned i = 0; i < 500000; i++) {
+        string str;
+        for (unsigned len = rng() % 12; len > 0; len--) {
+            str += alphabet[rng() % alphabet.size()];
+        }
+        checker.check(str);
+    }
+
+    checker.print_summary();
+    if (not checker.passed()) {
+        throw runtime_error("parse_floating() disagrees with from_chars() or strtod()");
+    }
+}
+
+int main() {
+    try {
+        floatutil_check();
+    } catch (const exception & e) {
+        cerr << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -7,9 +7,18 @@
 #include <tuple>
 #include <charconv>
 #include <map>
+#include <set>
 #include <cstring>
 #include <fstream>
+#include <memory>
+#include <thread>
+#include <exception>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <numeric>
 #include <unistd.h>
+#include <getopt.h>
 
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -17,51 +26,69 @@
 
 #include <sys/time.h>
 #include <sys/resource.h>
-#include <crypto++/base64.h>
+#include <google/dense_hash_map>
+#include <boost/functional/hash.hpp>
 
 #include "dateutil.hh"
 #include "analyzeutil.hh"
+#include "mmaputil.hh"
+#include "pipeutil.hh"
+#include "metricsutil.hh"
+#include "splitutil.hh"
+#include "streamstatsutil.hh"
 
 using namespace std;
 using namespace std::literals;
 
 /** 
- * From stdin, parses influxDB export, which contains one line per key/value field
+ * From stdin (or an export file, see --export-file), parses influxDB export, which contains one line per key/value field
  * (e.g. cum_rebuf), along with the tags corresponding to that field 
  * (e.g. timestamp, server, and channel).
  * For each measurement type (e.g. client_buffer), 
  * outputs a csv containing one line per "datapoint", i.e. all fields recorded 
  * with a given set of tags (e.g. a single Event).
  * Takes date as argument.
+ * An export file is memory-mapped and parsed in parallel chunks (see Parser::parse_export_file()).
  */
 
 #define NS_PER_SEC 1000000000UL
 // Bytes of random data used as public session ID after base64 encoding
 static constexpr unsigned BYTES_OF_ENTROPY = 32;
+// Length of base64-encoded session ID (including padding)
+static constexpr unsigned SESSION_ID_LENGTH = (BYTES_OF_ENTROPY + 2) / 3 * 4;
 
-// if delimiter is at end, adds empty string to ret
-void split_on_char(const string_view str, const char ch_to_find, vector<string_view> & ret) {
-    ret.clear();
+constexpr uint64_t SERVER_COUNT = 255;
 
-    bool in_double_quoted_string = false;
-    unsigned int field_start = 0;   // start of next token
-    for (unsigned int i = 0; i < str.size(); i++) {
-        const char ch = str[i];
-        if (ch == '"') {
-            in_double_quoted_string = !in_double_quoted_string;
-        } else if (in_double_quoted_string) {
-            continue;
-        } else if (ch == ch_to_find) {
-            ret.emplace_back(str.substr(field_start, i - field_start));
-            field_start = i + 1;
+/* Which measurements to parse (the rest are skipped without being parsed) */
+using measurement_set = array<bool, N_MEASUREMENTS>;
+
+/* Parse a comma-separated list of measurements (e.g. client_buffer,video_sent).
+ * Only measurements that are stored can be listed; video_sent and video_acked
+ * also need client_buffer, whose events determine stream IDs. */
+measurement_set parse_measurement_list(const string_view list) {
+    static constexpr array<Measurement, 6> stored = {
+        Measurement::client_buffer, Measurement::client_sysinfo, Measurement::ssim,
+        Measurement::video_acked, Measurement::video_sent, Measurement::video_size
+    };
+
+    measurement_set selected{};
+    vector<string_view> names;
+    split_on_char(list, ',', names);
+    for (const string_view name : names) {
+        const Measurement measurement = Measurement(measurements(name));
+        if (find(stored.begin(), stored.end(), measurement) == stored.end()) {
+            throw runtime_error("can't select measurement: " + string(name));
         }
+        selected[size_t(measurement)] = true;
     }
 
-    ret.emplace_back(str.substr(field_start));
+    if ((selected[size_t(Measurement::video_sent)] or selected[size_t(Measurement::video_acked)])
+            and not selected[size_t(Measurement::client_buffer)]) {
+        throw runtime_error("video_sent and video_acked require client_buffer (for stream IDs)");
+    }
+    return selected;
 }
 
-constexpr uint64_t SERVER_COUNT = 255;
-
 // server_id identifies a daemon serving a given scheme
 uint64_t get_server_id(const vector<string_view> & fields) {
     uint64_t server_id = -1;
@@ -79,22 +106,132 @@ uint64_t get_server_id(const vector<string_view> & fields) {
     return server_id;
 }
 
+// Pending datapoints a table holds before folding them into its rows, at least (see timestamp_table)
+static constexpr size_t MIN_PENDING_FOLD = 256;
+
+/* Datapoints of one measurement (for one server/channel or format/channel), keyed by timestamp.
+ * Stored as a flat vector sorted by timestamp, instead of a map with one node per timestamp.
+ * Each line of the export sets one field of a datapoint, and influx export emits each field of
+ * a series in timestamp order. So a line either starts a datapoint at a new latest timestamp
+ * (appended in order), or sets another field in a datapoint near the previously found one.
+ * Lines that fit neither case are appended to an unsorted pending list, 
+ * which finalize() sorts once and coalesces (in line order, using T::merge()).
+ * The pending list is also folded in whenever it outgrows the rows (or MIN_PENDING_FOLD), so out-of-order
+ * input (one full T per line) takes at most about twice the memory of the finished table. */
+template <typename T>
+class timestamp_table {
+    using row = pair<uint64_t, T>;
+
+    vector<row> rows_{};        // sorted by ts, one row per ts
+    vector<row> pending_{};     // partial datapoints in line order (ts not in rows_ when appended)
+    size_t cursor_ = 0;         // index in rows_ of last datapoint found
+
+    /* Sort pending datapoints into rows_ (see finalize()); pending_ keeps its capacity for reuse */
+    void fold_pending() {
+        if (pending_.empty()) {
+            return;
+        }
+        stable_sort(pending_.begin(), pending_.end(),
+                    [](const row & a, const row & b) { return a.first < b.first; });
+
+        vector<row> merged;
+        merged.reserve(rows_.size() + pending_.size());
+        const auto append = [&merged](row && r) {
+            if (not merged.empty() and merged.back().first == r.first) {
+                merged.back().second.merge(r.second);
+            } else {
+                merged.emplace_back(move(r));
+            }
+        };
+
+        auto pending = pending_.begin();
+        for (auto & r : rows_) {
+            // rows_ precede pending datapoints with the same ts 
+            while (pending != pending_.end() and pending->first < r.first) {
+                append(move(*pending++));
+            }
+            append(move(r));
+        }
+        while (pending != pending_.end()) {
+            append(move(*pending++));
+        }
+
+        rows_ = move(merged);
+        pending_.clear();
+        cursor_ = 0;
+    }
+
+    public:
+    /* Datapoint at ts, starting a new one if needed */
+    T & operator[](const uint64_t ts) {
+        if (rows_.empty() or ts > rows_.back().first) {
+            cursor_ = rows_.size();
+            rows_.emplace_back(ts, T{});
+            return rows_.back().second;
+        }
+
+        // usually the same or the next datapoint as last time
+        if (cursor_ + 1 < rows_.size() and rows_[cursor_ + 1].first == ts) {
+            return rows_[++cursor_].second;
+        }
+        if (rows_[cursor_].first != ts) {
+            const auto found = lower_bound(rows_.begin(), rows_.end(), ts,
+                    [](const row & r, const uint64_t t) { return r.first < t; });
+            if (found == rows_.end() or found->first != ts) {
+                // consecutive lines of the same datapoint share one pending entry
+                if (pending_.empty() or pending_.back().first != ts) {
+                    if (pending_.size() >= max(rows_.size(), MIN_PENDING_FOLD)) {
+                        fold_pending();         // ts may now be in rows_
+                        return (*this)[ts];
+                    }
+                    pending_.emplace_back(ts, T{});
+                }
+                return pending_.back().second;
+            }
+            cursor_ = found - rows_.begin();
+        }
+        return rows_[cursor_].second;
+    }
+
+    /* Append (the finalized rows of) a table built from lines that followed ours;
+     * coalesced by the next finalize() */
+    void absorb(timestamp_table && later) {
+        if (rows_.empty() and pending_.empty()) {
+            *this = move(later);
+            return;
+        }
+        pending_.insert(pending_.end(), make_move_iterator(later.rows_.begin()), 
+                                        make_move_iterator(later.rows_.end()));
+        later.rows_ = {};
+    }
+
+    /* Fold pending datapoints into rows_, and release unused capacity. Must be called before iterating. 
+     * Partial datapoints with equal ts are merged in line order, so contradictions
+     * mark the datapoint bad exactly as if every line had gone straight to one datapoint. */
+    void finalize() {
+        fold_pending();
+        pending_ = {};
+        rows_.shrink_to_fit();
+    }
+
+    bool empty() const { return rows_.empty() and pending_.empty(); }
+
+    typename vector<row>::iterator begin() { return rows_.begin(); }
+    typename vector<row>::iterator end() { return rows_.end(); }
+    typename vector<row>::const_iterator begin() const { return rows_.begin(); }
+    typename vector<row>::const_iterator end() const { return rows_.end(); }
+};
+
 /* Two datapoints are considered part of the same event (i.e. same Event struct) iff they share 
  * {timestamp, server, channel}. 
  * Two events with the same ts may come to a given server, so use channel to help
  * disambiguate (see 2019-04-30:2019-05-01 1556622001697000000). */
-using event_table = map<uint64_t, Event>;
-/*                      timestamp */
-using sysinfo_table = map<uint64_t, Sysinfo>;
-/*                        timestamp */
-using video_sent_table = map<uint64_t, VideoSent>;
-/*                           timestamp */
-using video_acked_table = map<uint64_t, VideoAcked>;
-/*                            timestamp */
-using video_size_table = map<uint64_t, VideoSize>;
-/*                           timestamp */
-using ssim_table = map<uint64_t, SSIM>;
-/*                               timestamp */
+using event_table = timestamp_table<Event>;
+using sysinfo_table = timestamp_table<Sysinfo>;
+using video_sent_table = timestamp_table<VideoSent>;
+using video_acked_table = timestamp_table<VideoAcked>;
+using video_size_table = timestamp_table<VideoSize>;
+using ssim_table = timestamp_table<SSIM>;
 
 /* Fully identifies a stream, for convenience. */
 struct private_stream_key {
@@ -143,10 +280,16 @@ struct stream_index {
     int                      index{};  
 };
 
+/* Base64-encoded session ID, stored in place (no allocation per session) */
+struct session_id_slot {
+    array<char, SESSION_ID_LENGTH> chars{};
+    operator string_view() const { return {chars.data(), chars.size()}; }
+};
+
 /* Session ID and list of *disambiguous* streams corresponding to a 
  * given *ambiguous* stream ID. */
 struct public_stream_ids_list {
-    string session_id{}; // random string
+    session_id_slot session_id{}; // random string
     /* This vector usually has one element, but if the server_id changes mid-session,
      * will contain an element for each server_id. */
     vector<stream_index> streams{};
@@ -155,6 +298,179 @@ struct public_stream_ids_list {
 using stream_ids_table = map<ambiguous_stream_id, public_stream_ids_list>;
 typedef map<ambiguous_stream_id, public_stream_ids_list>::iterator stream_ids_iterator;
 
+/* Full private stream key, unpacked for hash: {init_id, user_id, expt_id, server, channel}.
+ * Streams with first_init_id are indexed by their session's {first_init_id, user_id} alone,
+ * with server = ANY_SERVER (they match any expt_id/server/channel). */
+using public_id_key = tuple<uint32_t, uint32_t, uint32_t, uint64_t, uint8_t>;
+static constexpr uint64_t ANY_SERVER = -2ULL;   // server is an index, so never this large
+static constexpr uint64_t EMPTY_SERVER = -1ULL; // dense_hash_map empty key
+
+/* Handle to a stream's public IDs; session_id points into stream_ids */
+struct public_stream_handle {
+    string_view session_id{};
+    unsigned    index{};
+};
+
+/* Result of public ID lookup; misses are expected for some measurements (see get_anonymous_ids) */
+enum class public_id_status { found, ambiguous_not_found, disambiguous_not_found };
+
+/* Generates cryptographically random public session IDs.
+ * Entropy is drawn a block at a time (for SESSION_ID_BATCH sessions), and each ID 
+ * is base64-encoded with a lookup table straight into its slot. */
+class SessionIdGenerator {
+    static constexpr unsigned SESSION_ID_BATCH = 1024;
+    static constexpr size_t MAX_GETENTROPY_BYTES = 256;    // getentropy() fails above this
+    static constexpr char BASE64_CHARS[] = 
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    array<uint8_t, SESSION_ID_BATCH * BYTES_OF_ENTROPY> entropy_{};
+    size_t entropy_used_ = entropy_.size();
+
+    void refill() {
+        for (size_t offset = 0; offset < entropy_.size(); offset += MAX_GETENTROPY_BYTES) {
+            if (getentropy(entropy_.data() + offset, 
+                           min(MAX_GETENTROPY_BYTES, entropy_.size() - offset)) != 0) {
+                throw runtime_error(string("Failed to generate public session ID: ") + strerror(errno));
+            }
+        }
+        entropy_used_ = 0;
+    }
+
+    public:
+    void generate(session_id_slot & session_id) {
+        if (entropy_used_ == entropy_.size()) {
+            refill();
+        }
+        const uint8_t * in = entropy_.data() + entropy_used_;
+        char * out = session_id.chars.data();
+        unsigned i = 0;
+        for (; i + 3 <= BYTES_OF_ENTROPY; i += 3, in += 3, out += 4) {
+            const uint32_t bits = in[0] << 16 | in[1] << 8 | in[2];
+            out[0] = BASE64_CHARS[bits >> 18];
+            out[1] = BASE64_CHARS[bits >> 12 & 63];
+            out[2] = BASE64_CHARS[bits >> 6 & 63];
+            out[3] = BASE64_CHARS[bits & 63];
+        }
+        // pad the last (partial) group
+        if constexpr (BYTES_OF_ENTROPY % 3 == 2) {
+            const uint32_t bits = in[0] << 16 | in[1] << 8;
+            out[0] = BASE64_CHARS[bits >> 18];
+            out[1] = BASE64_CHARS[bits >> 12 & 63];
+            out[2] = BASE64_CHARS[bits >> 6 & 63];
+            out[3] = '=';
+        } else if constexpr (BYTES_OF_ENTROPY % 3 == 1) {
+            const uint32_t bits = in[0] << 16;
+            out[0] = BASE64_CHARS[bits >> 18];
+            out[1] = BASE64_CHARS[bits >> 12 & 63];
+            out[2] = '=';
+            out[3] = '=';
+        }
+
+        // don't leave used entropy lying around
+        fill_n(entropy_.data() + entropy_used_, BYTES_OF_ENTROPY, 0);
+        entropy_used_ += BYTES_OF_ENTROPY;
+    }
+};
+
+/* Identifies the table an export line belongs to: 
+ * {measurement, server (or format, for video_size/ssim), channel} */
+using shard_key = tuple<string_view, uint64_t, uint8_t>;
+
+/* Spills export lines to one temporary file per shard (see --spill-dir), so that
+ * each shard's table can later be built, used, and freed on its own. 
+ * Lines are buffered per shard and appended to the shard's file in blocks,
+ * so only one file is open at a time and buffer memory stays bounded. */
+class ShardSpiller {
+    static constexpr size_t FLUSH_BYTES = 64 * 1024;                // per shard
+    static constexpr size_t MAX_BUFFERED_BYTES = 32 * 1024 * 1024;  // over all shards
+
+    string dir_{};
+    map<shard_key, string> buffers_{};  // lines not yet written, per shard
+    size_t buffered_bytes_ = 0;
+    set<shard_key> spilled_{};          // shards with a file
+
+    string shard_filename(const shard_key & shard) const {
+        const auto & [measurement, outer_id, channel_id] = shard;
+        return dir_ + "/" + string(measurement) + "_" + to_string(outer_id) + "_" + to_string(channel_id);
+    }
+
+    void flush(const shard_key & shard, string & buffer) {
+        const string filename = shard_filename(shard);
+        ofstream shard_file{filename, ios::app};
+        if (not shard_file.is_open()) {
+            throw runtime_error( "can't open " + filename);
+        }
+        shard_file << buffer;
+        shard_file.close();
+        if (shard_file.bad()) {
+            throw runtime_error("error writing " + filename);
+        }
+        spilled_.insert(shard);
+        buffered_bytes_ -= buffer.size();
+        buffer.clear();
+    }
+
+    public:
+    /* Creates a fresh temporary directory inside parent_dir */
+    explicit ShardSpiller(const string & parent_dir) {
+        string dir_template = parent_dir + "/influx_to_csv.XXXXXX";
+        if (not mkdtemp(dir_template.data())) {
+            throw runtime_error("can't create spill directory in " + parent_dir + ": " + strerror(errno));
+        }
+        dir_ = dir_template;
+    }
+
+    /* Removes the shard files and directory */
+    ~ShardSpiller() {
+        for (const auto & shard : spilled_) {
+            unlink(shard_filename(shard).c_str());
+        }
+        rmdir(dir_.c_str());
+    }
+
+    ShardSpiller(const ShardSpiller &) = delete;
+    ShardSpiller & operator=(const ShardSpiller &) = delete;
+
+    void spill(const shard_key & shard, const string_view line) {
+        string & buffer = buffers_[shard];
+        buffer.append(line);
+        buffer.push_back('\n');
+        buffered_bytes_ += line.size() + 1;
+        if (buffer.size() >= FLUSH_BYTES) {
+            flush(shard, buffer);
+        }
+        if (buffered_bytes_ >= MAX_BUFFERED_BYTES) {
+            flush_all();
+        }
+    }
+
+    /* Write out all buffered lines, and free the buffers */
+    void flush_all() {
+        for (auto & [shard, buffer] : buffers_) {
+            if (not buffer.empty()) {
+                flush(shard, buffer);
+            }
+        }
+        buffers_.clear();
+    }
+
+    /* Call fn on each line spilled to shard (in spill order), if any */
+    template <typename LineFn>
+    void for_each_spilled_line(const shard_key & shard, LineFn fn) const {
+        if (not spilled_.count(shard)) {
+            return;
+        }
+        const MappedFile shard_file{shard_filename(shard)};
+        for_each_line(shard_file.contents(), fn);
+    }
+};
+
+/* Rows and bytes of csv written by a dump */
+struct DumpTotals {
+    uint64_t rows = 0;
+    uint64_t bytes = 0;
+};
+
 /* Whenever a timestamp is used to represent a day, round down to Influx backup hour.
  * Influx records ts as nanoseconds - use nanoseconds when writing ts to csv. */
 using Day_ns = uint64_t;
@@ -177,36 +493,69 @@ private:
     
     // Note: dump_measurement() uses the names of the measurement array members
 
-    // client_buffer[server][channel] = map<ts, Event>
+    // client_buffer[server][channel] = timestamp_table<Event>
     array<vector<event_table>, SERVER_COUNT> client_buffer{}; 
     
-    // client_sysinfo[server] = map<ts, SysInfo>
+    // client_sysinfo[server] = timestamp_table<SysInfo>
     array<sysinfo_table, SERVER_COUNT> client_sysinfo{};
     
-    // video_sent[server][channel] = map<ts, VideoSent>
+    // video_sent[server][channel] = timestamp_table<VideoSent>
     array<vector<video_sent_table>, SERVER_COUNT> video_sent{}; 
 
-    // video_acked[server][channel] = map<ts, VideoAcked>
+    // video_acked[server][channel] = timestamp_table<VideoAcked>
     array<vector<video_acked_table>, SERVER_COUNT> video_acked{}; 
     
-    // video_size[format][channel] = map<ts, VideoSize>
+    // video_size[format][channel] = timestamp_table<VideoSize>
     // Insert the estimated number of (empty) inner vectors, so they can be reserved up front
     vector<vector<video_size_table>> video_size = vector<vector<video_size_table>>(N_FORMATS_ESTIMATE); 
     
-    // ssim[format][channel] = map<ts, SSIM>
+    // ssim[format][channel] = timestamp_table<SSIM>
     // Insert the estimated number of (empty) inner vectors, so they can be reserved up front
     vector<vector<ssim_table>> ssim = vector<vector<ssim_table>>(N_FORMATS_ESTIMATE); 
 
     stream_ids_table stream_ids{};
-    
-    unsigned int bad_count = 0;
+    SessionIdGenerator session_id_generator{};
+
+    // built from stream_ids once anonymized, for lookup on dump
+    google::dense_hash_map<public_id_key, public_stream_handle, boost::hash<public_id_key>> public_ids{};
+
     /* Timestamp range to be analyzed (influx export includes partial datapoints outside the requested range).
      * Any ts outside this range (inclusive) are rejected */
     pair<Day_ns, Day_ns> days{};
     size_t n_bad_ts = 0;
+
+    // measurements to parse (default: all that are stored); see parse_line()
+    measurement_set parsed_measurements = parse_measurement_list(
+            "client_buffer,client_sysinfo,ssim,video_acked,video_sent,video_size");
+    // lines skipped without parsing, per measurement
+    array<size_t, N_MEASUREMENTS> n_skipped_lines{};
     
     /* Date to analyze, e.g. 2019-07-01T11_2019-07-02T11 */
     const string date_str{};
+
+    /* If compressing (--compress), csvs are written as zstd frames (.csv.zst);
+     * each dump compresses on csv_zstd_threads threads, set when the dumps are started */
+    bool compressing = false;
+    unsigned csv_zstd_threads = 0;
+
+    CSVWriter open_csv(const string & meas_name) const {
+        const string filename = meas_name + "_" + date_str + ".csv";
+        if (compressing) {
+            return CSVWriter{filename + ".zst", csv_zstd_threads};
+        }
+        return CSVWriter{filename};
+    }
+
+    /* Two-pass mode (--spill-dir): during the first pass (spilling == true), lines of 
+     * client_buffer, video_sent, video_acked, video_size and ssim are only tokenized
+     * (to intern their tags and ids in line order) and spilled to per-shard files.
+     * Each shard's table is then parsed from its file when it is needed, and freed afterwards,
+     * so peak memory scales with the largest shard rather than with the whole day. */
+    unique_ptr<ShardSpiller> spiller{};
+    bool spilling = false;
+    unsigned int shard_line_no = 0;
+    // shards loaded so far (client_buffer is loaded twice: to group stream ids, then to dump)
+    set<tuple<string, uint64_t, uint8_t>> loaded_shards{};
         
     /* Get index corresponding to the string value of a tag. 
      * Updates the tag's string <=> index table as needed.
@@ -216,21 +565,20 @@ private:
      * tag_key: e.g. channel */
     uint8_t get_tag_id(const vector<string_view> & tags, string_view tag_key, 
                        string_table& table) {
-        string value_str; 
-        string_view tag_prefix = string(tag_key) + "=";
-        unsigned prefix_len = tag_prefix.length();
-        
+        string_view value; 
         for (const auto & tag : tags) {
-            if (not tag.compare(0, prefix_len, tag_prefix)) {
-                value_str = string(tag.substr(prefix_len));
+            // tag is e.g. channel=abc
+            if (tag.size() > tag_key.size() and tag[tag_key.size()] == '=' 
+                    and tag.substr(0, tag_key.size()) == tag_key) {
+                value = tag.substr(tag_key.size() + 1);
             }
         }
 
-        if (value_str.empty()) {
+        if (value.empty()) {
             throw runtime_error(string(tag_key) + " missing");
         }
         // Insert new value if needed
-        return table.forward_map_vivify(value_str);
+        return table.forward_map_vivify(value);
     }
 
     /* Get the numeric value of a dynamic "tag". 
@@ -263,24 +611,8 @@ private:
         return tag_id;
     }
     
-    /* Generate random base64-encoded session ID, insert to stream_ids. */
-    void generate_session_id(public_stream_ids_list & public_ids_list) {
-        uint8_t random_bytes[BYTES_OF_ENTROPY]; // avoid conflicting byte definitions
-        int entropy_ret = getentropy(random_bytes, BYTES_OF_ENTROPY);
-        if (entropy_ret != 0) {
-            throw runtime_error(string("Failed to generate public session ID: ") + strerror(errno));
-        }
-        // encode as base64 in-place in stream_ids 
-        CryptoPP::StringSource ss(random_bytes, BYTES_OF_ENTROPY, true,
-            new CryptoPP::Base64Encoder(    // CryptoPP takes ownership
-                new CryptoPP::StringSink(public_ids_list.session_id),
-                /* insertLineBreaks = */ false
-            ) 
-        ); 
-    }
-    
-    /* Given private stream id, return public session ID and stream index.
-     * Throws if public IDs not found, which represents some logic error for
+    /* Given private stream id, fill in public session ID and stream index.
+     * Returns a miss status if public IDs not found, which represents some logic error for
      * client_buffer, but not for video_sent (e.g. 2019-03-30T11_2019-03-31T11
      * has a video_sent with init_id 901804980 belonging to a stream with no corresponding 
      * client_buffer.)
@@ -288,66 +620,73 @@ private:
      * (by using video_sent as well as client_buffer to build stream_ids), 
      * but a video_sent with no corresponding 
      * client_buffer seems spurious, so ignore such chunks for now. */
-    public_stream_id get_anonymous_ids(const private_stream_key & stream_key) {
-        optional<uint32_t> first_init_id = stream_key.first_init_id;
-        // Look up anonymous session/stream ID
-        ambiguous_stream_id private_id = 
-            {first_init_id.value_or(stream_key.init_id), stream_key.user_id};
-        const stream_id_disambiguation disambiguation = 
-            {stream_key.expt_id, stream_key.server, stream_key.channel};
-        const stream_ids_iterator found_ambiguous_stream = stream_ids.find(private_id);
-        if (found_ambiguous_stream == stream_ids.end()) {
-            throw runtime_error( "Failed to find anonymized session/stream ID for init_id " 
-                                  + to_string(stream_key.init_id) + ", user " + to_string(stream_key.user_id) 
-                                  + " (ambiguous stream ID not found)" );
-        }
-        
-        unsigned index;
-        public_stream_ids_list& found_public_ids = found_ambiguous_stream->second;
-       
+    public_id_status get_anonymous_ids(const private_stream_key & stream_key, 
+                                       public_stream_handle & public_id) const {
+        const optional<uint32_t> first_init_id = stream_key.first_init_id;
         if (first_init_id) {
             // If private_stream_key has first_init_id, its session only appears once in stream_ids,
             // calculate index 
-            index = stream_key.init_id - *first_init_id;
-        } else {
-            vector<stream_index> & found_streams = found_public_ids.streams;
-            auto found_disambiguous_stream = find_if(found_streams.begin(), found_streams.end(),
-                 [&disambiguation] (const stream_index& s) { return s.disambiguation == disambiguation; });
-            if (found_disambiguous_stream == found_streams.end()) {
-                throw runtime_error( "Failed to find anonymized session/stream ID for init_id " 
-                                      + to_string(stream_key.init_id) 
-                                      + " (disambiguous stream ID not found)" );
+            const auto found_session = public_ids.find(
+                    {*first_init_id, stream_key.user_id, 0, ANY_SERVER, 0});
+            if (found_session == public_ids.end()) {
+                return public_id_status::ambiguous_not_found;
             }
-            index = found_disambiguous_stream->index;
+            public_id = {found_session->second.session_id, stream_key.init_id - *first_init_id};
+            return public_id_status::found;
         }
 
-        return {found_public_ids.session_id, index};
+        const auto found_stream = public_ids.find({stream_key.init_id, stream_key.user_id, 
+                stream_key.expt_id, stream_key.server, stream_key.channel});
+        if (found_stream == public_ids.end()) {
+            // only distinguish the kind of miss when reporting it
+            const bool found_session = public_ids.count(
+                    {stream_key.init_id, stream_key.user_id, 0, ANY_SERVER, 0});
+            return found_session ? public_id_status::disambiguous_not_found 
+                                 : public_id_status::ambiguous_not_found;
+        }
+        public_id = found_stream->second;
+        return public_id_status::found;
+    }
+
+    static string public_id_miss_message(const private_stream_key & stream_key, 
+                                         const public_id_status status) {
+        if (status == public_id_status::ambiguous_not_found) {
+            return "Failed to find anonymized session/stream ID for init_id " 
+                   + to_string(stream_key.init_id) + ", user " + to_string(stream_key.user_id) 
+                   + " (ambiguous stream ID not found)";
+        }
+        return "Failed to find anonymized session/stream ID for init_id " 
+               + to_string(stream_key.init_id) + " (disambiguous stream ID not found)";
     }
 
     /* Dump an array of measurements to csv, including session ID from stream_ids.
      * For events without first_init_id, stream index was also recorded in stream_ids.
      * For events with first_init_id, stream index is calculated as init_id - first_init_id.
      * meas_arr should be some container<vector<T_table>>, where T provides anon_keys/values() and
-     * has first_init_id, init_id, user_id, expt_id as optional members */
+     * has first_init_id, init_id, user_id, expt_id as optional members.
+     * If stream_stats is given, each dumped datapoint is also added to it (with its public ID);
+     * the csv is only written if write_csv. Returns the rows and bytes written. */
     template <typename MeasurementArray>
-    void dump_private_measurement(const MeasurementArray & meas_arr, const string & meas_name) {
-        const string & dump_filename = meas_name + "_" + date_str + ".csv";
-        ofstream dump_file{dump_filename};
-        if (not dump_file.is_open()) {
-            throw runtime_error( "can't open " + dump_filename);
+    DumpTotals dump_private_measurement(MeasurementArray & meas_arr, const string & meas_name,
+                                        const bool write_csv, StreamStats * const stream_stats) {
+        DumpTotals totals;
+        optional<CSVWriter> dump_file;
+        if (write_csv) {
+            dump_file.emplace(open_csv(meas_name));
+            *dump_file << "time (ns GMT),session_id,index,expt_id,channel,";
         }
-        
-        dump_file << "time (ns GMT),session_id,index,expt_id,channel,";
         bool wrote_header = false; 
 
         // Write all datapoints
         for (uint64_t server = 0; server < meas_arr.size(); server++) {
             for (uint8_t channel_id = 0; channel_id < meas_arr[server].size(); channel_id++) {
+                load_shard(meas_arr[server][channel_id], {meas_name, server, channel_id});
                 for (const auto & [ts,datapoint] : meas_arr[server][channel_id]) {
                     if (datapoint.bad) {
-                        bad_count++;
-                        cerr << "Skipping bad data point (of " << bad_count << " total) with contradictory values "
-                                "(while dumping measurements).\n";
+                        diagnostics().report("skipped_bad_" + meas_name, [&](ostream & out) {
+                            out << "Skipping bad " << meas_name << " data point with timestamp " << ts
+                                << " with contradictory values (while dumping measurements).\n";
+                        });
                         continue;
                     }
                     if (not datapoint.complete()) {
@@ -357,58 +696,81 @@ private:
 
                     // Write column header using the first datapoint encountered 
                     // (note there may not be a datapoint at server=channel=0)
-                    if (not wrote_header) {
-                        dump_file << datapoint.anon_keys() << "\n";
+                    if (dump_file and not wrote_header) {
+                        *dump_file << datapoint.anon_keys() << "\n";
                         wrote_header = true;
                     }
 
                     // Get anonymous session/stream ID for datapoint
-                    public_stream_id public_id; 
-                    try {   
-                        public_id = 
-                            get_anonymous_ids({datapoint.first_init_id, *datapoint.init_id,
-                                *datapoint.user_id, *datapoint.expt_id, server, channel_id});
-                    } catch (const exception & e) {
+                    const private_stream_key stream_key{datapoint.first_init_id(), *datapoint.init_id(),
+                        *datapoint.user_id(), *datapoint.expt_id(), server, channel_id};
+                    public_stream_handle public_id;
+                    const public_id_status status = get_anonymous_ids(stream_key, public_id);
+                    if (status != public_id_status::found) {
                         /* All Events should have IDs, but the other datapoints may not -- 
                          * see comment on get_anonymous_ids */
                         if (meas_name == "client_buffer") {
-                            throw;
+                            throw runtime_error(public_id_miss_message(stream_key, status));
                         }
-                        cerr << "Datapoint with timestamp " << ts << " has no corresponding event: " 
-                             << e.what() << "\n";
+                        diagnostics().report(meas_name + "_without_event", [&](ostream & out) {
+                            out << "Datapoint with timestamp " << ts << " has no corresponding event: " 
+                                << public_id_miss_message(stream_key, status) << "\n";
+                        });
                         continue;   // don't dump this chunk
                     }
                     
+                    if (stream_stats) {
+                        add_to_stream_stats(*stream_stats, public_id, ts, datapoint);
+                    }
+                    if (not dump_file) {
+                        continue;
+                    }
+                    
+                    *dump_file << ts << "," 
+                               << public_id.session_id << ","
+                               << public_id.index << ","
+                               << *datapoint.expt_id() << ","
+                               << channels.reverse_map(channel_id) << ",";
                     // video_sent requires formats table to get format string
-                    const string & anon_values = meas_name == "video_sent" ? 
-                        datapoint.anon_values(formats) : datapoint.anon_values();
-                
-                    dump_file << ts << "," 
-                              << public_id.session_id << ","
-                              << public_id.index << ","
-                              << *datapoint.expt_id << ","
-                              << channels.reverse_map(channel_id) << "," 
-                              << anon_values << "\n";
+                    if (meas_name == "video_sent") {
+                        datapoint.write_anon_values(*dump_file, formats);
+                    } else {
+                        datapoint.write_anon_values(*dump_file);
+                    }
+                    *dump_file << "\n";
+                    totals.rows++;
                 }
+                unload_shard(meas_arr[server][channel_id]);
             }
         }
 
-        dump_file.close();   
-        if (dump_file.bad()) {
-            throw runtime_error("error writing " + dump_filename);
+        if (dump_file) {
+            dump_file->close();
+            totals.bytes = dump_file->bytes_written();
         }
+        return totals;
     }
 
+    /* Stream statistics summarize each stream's events and chunks; acks aren't used */
+    static void add_to_stream_stats(StreamStats & stream_stats, const public_stream_handle & public_id,
+                                    const uint64_t ts, const Event & event) {
+        stream_stats.add_event(public_id.session_id, public_id.index, ts, event);
+    }
+    static void add_to_stream_stats(StreamStats & stream_stats, const public_stream_handle & public_id,
+                                    const uint64_t ts, const VideoSent & video_sent) {
+        stream_stats.add_chunk(public_id.session_id, public_id.index, ts, video_sent);
+    }
+    static void add_to_stream_stats(StreamStats &, const public_stream_handle &,
+                                    const uint64_t, const VideoAcked &) {}
+
     /* meas_arr should be some container<vector<T_table>>, where T provides anon_keys/values(). 
      * Separate from dump_private to allow templating 
-     * (private version requires private fields like init_id, which public measurements don't have) */
+     * (private version requires private fields like init_id, which public measurements don't have).
+     * Returns the rows and bytes written. */
     template <typename MeasurementArray>
-    void dump_public_measurement(const MeasurementArray & meas_arr, const string & meas_name) {
-        const string & dump_filename = meas_name + "_" + date_str + ".csv";
-        ofstream dump_file{dump_filename};
-        if (not dump_file.is_open()) {
-            throw runtime_error( "can't open " + dump_filename);
-        }
+    DumpTotals dump_public_measurement(MeasurementArray & meas_arr, const string & meas_name) {
+        DumpTotals totals;
+        CSVWriter dump_file = open_csv(meas_name);
 
         // Write column header using any datapoint (here, the first one)
         // Current non-anonymous measurements of interest (video_size, ssim) have format and channel as tags
@@ -418,11 +780,13 @@ private:
         // Write all datapoints
         for (uint8_t format_id = 0; format_id < meas_arr.size(); format_id++) {
             for (uint8_t channel_id = 0; channel_id < meas_arr.at(format_id).size(); channel_id++) {
+                load_shard(meas_arr[format_id][channel_id], {meas_name, format_id, channel_id});
                 for (const auto & [ts,datapoint] : meas_arr[format_id][channel_id]) {
                     if (datapoint.bad) {
-                        bad_count++;
-                        cerr << "Skipping bad data point (of " << bad_count << " total) with contradictory values "
-                                "(while dumping measurements).\n";
+                        diagnostics().report("skipped_bad_" + meas_name, [&](ostream & out) {
+                            out << "Skipping bad " << meas_name << " data point with timestamp " << ts
+                                << " with contradictory values (while dumping measurements).\n";
+                        });
                         continue;
                     }
                     if (not datapoint.complete()) {
@@ -439,20 +803,80 @@ private:
                     
                     dump_file << ts << ","
                               << formats.reverse_map(format_id) << ","
-                              << channels.reverse_map(channel_id) << "," 
-                              << datapoint.anon_values() << "\n";
+                              << channels.reverse_map(channel_id) << ",";
+                    datapoint.write_anon_values(dump_file);
+                    dump_file << "\n";
+                    totals.rows++;
                 }
+                unload_shard(meas_arr[format_id][channel_id]);
             }
         }
 
-        dump_file.close();   
-        if (dump_file.bad()) {
-            throw runtime_error("error writing " + dump_filename);
-        }
+        dump_file.close();
+        totals.bytes = dump_file.bytes_written();
+        return totals;
     }
     
+    /* In two-pass mode, build a shard's (empty) table from its spilled lines.
+     * Anomalies (e.g. contradictory values) are only reported the first time a shard is loaded. */
+    template <typename Table>
+    void load_shard(Table & table, const shard_key & shard) {
+        if (not spiller) {
+            return;
+        }
+        const auto & [meas_name, tag_id, channel_id] = shard;
+        // (per thread, so only covers this Parser, which reloads on the calling thread)
+        optional<Diagnostics::Suppression> suppression;
+        if (not loaded_shards.emplace(string(meas_name), tag_id, channel_id).second) {
+            suppression.emplace();
+        }
+        spiller->for_each_spilled_line(shard, [&](const string_view line) {
+            parse_line(line, ++shard_line_no);
+        });
+        table.finalize();
+    }
+
+    /* In two-pass mode, free a shard's table once it has been used */
+    template <typename Table>
+    void unload_shard(Table & table) {
+        if (spiller) {
+            table = {};
+        }
+    }
+
+    /* First pass of two-pass mode: record the line in its shard's file.
+     * Usernames and formats are interned here, in line order, so ids match a one-pass parse. */
+    void spill_line(const shard_key & shard, const string_view key, const string_view value,
+                    const string_view line) {
+        if (key == "user"sv or (key == "format"sv and get<0>(shard) == "video_sent"sv)) {
+            if (value.size() <= 2 or value.front() != '"' or value.back() != '"') {
+                throw runtime_error("invalid " + string(key) + " string: " + string(value));
+            }
+            string_table & table = key == "user"sv ? usernames : formats;
+            table.forward_map_vivify(value.substr(1, value.size() - 2));
+        }
+        spiller->spill(shard, line);
+    }
+
     public:
 
+    /* Parse only the given measurements (see parse_measurement_list()) */
+    void parse_only(const measurement_set & selected) {
+        parsed_measurements = selected;
+    }
+
+    /* Enable two-pass mode: the next parse_stdin()/parse_export_file() spills shards 
+     * to a temporary directory inside spill_dir (removed when the Parser is destroyed) */
+    void spill_to(const string & spill_dir) {
+        spiller = make_unique<ShardSpiller>(spill_dir);
+        spilling = true;
+    }
+
+    /* Write csvs zstd-compressed, as <measurement>_<date>.csv.zst */
+    void compress_csvs() {
+        compressing = true;
+    }
+
     /* Group client_buffer by user_id and first_init_id if available, 
      * else un-decremented init_id.
      * After grouping, each key in stream_ids represents 
@@ -462,6 +886,7 @@ private:
         unsigned line_no = 0;
         for (uint8_t server = 0; server < client_buffer.size(); server++) {
             for (uint8_t channel = 0; channel < client_buffer[server].size(); channel++) {
+                load_shard(client_buffer[server][channel], {"client_buffer"sv, server, channel});
                 for (const auto & [ts,event] : client_buffer[server][channel]) {
                     if (line_no % 1000000 == 0) {
                         const size_t rss = memcheck() / 1024;
@@ -470,9 +895,11 @@ private:
                     line_no++;
 
                     if (event.bad) {
-                        // bad_count++ happens in dump(), for all datapoints
-                        cerr << "Skipping bad data point (of " << bad_count 
-                             << " total) with contradictory values (while grouping stream IDs).\n";
+                        // counted as skipped_bad_client_buffer in dump(), for all datapoints
+                        if (diagnostics().verbose()) {
+                            cerr << "Skipping bad data point with timestamp " << ts
+                                 << " with contradictory values (while grouping stream IDs).\n";
+                        }
                         continue;
                     }
                     if (not event.complete()) {
@@ -481,12 +908,12 @@ private:
                                             + to_string(ts));
                     }
 
-                    optional<uint32_t> first_init_id = event.first_init_id;
+                    optional<uint32_t> first_init_id = event.first_init_id();
                     // Record with first_init_id, if available
                     ambiguous_stream_id private_id = 
-                        {first_init_id.value_or(*event.init_id), *event.user_id};
+                        {first_init_id.value_or(*event.init_id()), *event.user_id()};
                     stream_id_disambiguation disambiguation = 
-                        {*event.expt_id, server, channel};
+                        {*event.expt_id(), server, channel};
                     stream_ids_iterator found_ambiguous_stream = stream_ids.find(private_id);
                     if (found_ambiguous_stream != stream_ids.end() and not first_init_id) {
                         // This stream's {init_id, user_id} has already been recorded => 
@@ -519,6 +946,7 @@ private:
                         stream_ids.emplace(make_pair(private_id, new_stream_ids_list));
                     }
                 }
+                unload_shard(client_buffer[server][channel]);
             }
         }
     }
@@ -528,45 +956,63 @@ private:
      * Build stream_ids using client_buffer events. 
      * When dumping data, search stream_ids for stream key corresponding to each datapoint */
     void anonymize_stream_ids() {
-        /* Pass over stream IDs; all init_ids are recorded, so it's safe to decrement to search
-         * for previous streams in the session.
+        /* Pass over stream IDs; all init_ids are recorded, so the previous stream in the session
+         * is the nearest lower init_id (by less than MAX_INIT_ID_DECREMENT) with the same user.
          * This pass is required because sometimes two events have the same timestamp and user, but
          * the second one has a lower init_id (e.g. see 2019-03-31, init_ids 3977886231/3977886232)
          * So, there's no obvious way to build client_buffer such that init_ids within a session 
-         * are sorted -- sorting by ts, server, and channel is not enough. */
-        for (auto & [cur_private_id, cur_public_ids_list] : stream_ids) {
+         * are sorted -- sorting by ts, server, and channel is not enough. 
+         * Neighbors are found by sorting stream_ids by {user_id, init_id} once, rather than
+         * searching stream_ids for each decrement. stream_ids is still walked in its own 
+         * (init_id) order, so each stream's predecessor is anonymized before the stream itself. */
+        static constexpr uint32_t MAX_INIT_ID_DECREMENT = 1024;
+        vector<stream_ids_iterator> streams_in_order;
+        streams_in_order.reserve(stream_ids.size());
+        for (auto it = stream_ids.begin(); it != stream_ids.end(); it++) {
+            streams_in_order.emplace_back(it);
+        }
+
+        vector<size_t> by_user(streams_in_order.size());
+        iota(by_user.begin(), by_user.end(), 0);
+        sort(by_user.begin(), by_user.end(), [&streams_in_order] (size_t a, size_t b) {
+            const ambiguous_stream_id & x = streams_in_order[a]->first;
+            const ambiguous_stream_id & y = streams_in_order[b]->first;
+            return tie(x.user_id, x.init_id) < tie(y.user_id, y.init_id);
+        });
+
+        // previous_in_session[i] = position (in streams_in_order) of stream i's predecessor, if any
+        constexpr size_t NO_PREVIOUS = -1;
+        vector<size_t> previous_in_session(streams_in_order.size(), NO_PREVIOUS);
+        for (size_t i = 1; i < by_user.size(); i++) {
+            const ambiguous_stream_id & prev = streams_in_order[by_user[i - 1]]->first;
+            const ambiguous_stream_id & cur = streams_in_order[by_user[i]]->first;
+            if (prev.user_id == cur.user_id and cur.init_id - prev.init_id < MAX_INIT_ID_DECREMENT) {
+                previous_in_session[by_user[i]] = by_user[i - 1];
+            }
+        }
+
+        for (size_t i = 0; i < streams_in_order.size(); i++) {
+            public_stream_ids_list & cur_public_ids_list = streams_in_order[i]->second;
             bool is_first_init_id = cur_public_ids_list.streams.empty();
             if (is_first_init_id) { 
                 /* Streams with first_init_id are recorded with empty list of disambiguous
                  * streams, since there's no need to calculate a stream index (can be 
                  * calculated with subtraction on dump) */
-                /* No need to decrement -- if stream has first_init_id, record with that */
-                generate_session_id(cur_public_ids_list);
+                /* No need to search for previous stream -- if stream has first_init_id, record with that */
+                session_id_generator.generate(cur_public_ids_list.session_id);
             } else { 
-                stream_ids_iterator found_ambiguous_stream;
-                // Searching for a *different* session than the current one => start with decrement = 1
-                unsigned decrement;
-                for ( decrement = 1; decrement < 1024; decrement++ ) {
-                    found_ambiguous_stream = stream_ids.find({
-                            cur_private_id.init_id - decrement, cur_private_id.user_id});
-                    if (found_ambiguous_stream == stream_ids.end()) {
-                        // loop again
-                    } else {
-                        break;
-                    }
-                }
-
                 unsigned start_stream_index = 0;
 
-                if (found_ambiguous_stream == stream_ids.end()) {
+                if (previous_in_session[i] == NO_PREVIOUS) {
                     /* This is the first stream in session -- generate session id,
                      * fill in stream indexes starting from 0. */
-                    generate_session_id(cur_public_ids_list);
+                    session_id_generator.generate(cur_public_ids_list.session_id);
                 } else {
                     /* Already recorded this session via the previous ambiguous stream
                      * in the session => copy previous stream's session id, 
                      * fill in stream indexes starting from previous stream's last one */
-                    public_stream_ids_list& found_public_ids = found_ambiguous_stream->second;
+                    const public_stream_ids_list & found_public_ids = 
+                        streams_in_order[previous_in_session[i]]->second;
                     cur_public_ids_list.session_id = found_public_ids.session_id;
                     start_stream_index = found_public_ids.streams.back().index + 1;
                 }
@@ -578,10 +1024,33 @@ private:
         }   // end stream_ids loop
     }
 
+    /* Index the anonymized stream_ids by full private stream key, so each datapoint 
+     * is resolved with one hash lookup on dump (rather than a map walk and a scan of
+     * the session's disambiguous streams). Every session is also indexed with
+     * server = ANY_SERVER, for streams with first_init_id. */
+    void build_public_id_index() {
+        public_ids.set_empty_key({0, 0, 0, EMPTY_SERVER, 0});
+        size_t n_keys = stream_ids.size();
+        for (const auto & [private_id, public_ids_list] : stream_ids) {
+            n_keys += public_ids_list.streams.size();
+        }
+        public_ids.resize(n_keys);
+
+        for (const auto & [private_id, public_ids_list] : stream_ids) {
+            const string_view session_id = public_ids_list.session_id;
+            public_ids[{private_id.init_id, private_id.user_id, 0, ANY_SERVER, 0}] = {session_id, 0};
+            for (const auto & [disambiguation, index] : public_ids_list.streams) {
+                public_ids[{private_id.init_id, private_id.user_id, disambiguation.expt_id,
+                            disambiguation.server, disambiguation.channel}] 
+                    = {session_id, unsigned(index)};
+            }
+        }
+    }
+
     /* Useful for testing. Check that no two streams are assigned the same
      * {session_id, stream index} */
     void check_public_stream_id_uniqueness() const {
-        set<tuple<string, unsigned>> unique_public_stream_ids;
+        set<tuple<string_view, unsigned>> unique_public_stream_ids;
         for (const auto & [private_id, public_ids_list] : stream_ids) {
             for (const auto & disambiguous_stream : public_ids_list.streams) {
                 bool duplicate = unique_public_stream_ids.count(
@@ -622,12 +1091,86 @@ private:
      * 1) Populate measurement array during parse() (add tag key to get_dynamic_tag_id() for new tag)
      * 2) Define struct 
      * 3) Call dump_*_measurement() */
-    void dump_all_measurements() {
-        dump_private_measurement(client_buffer, VAR_NAME(client_buffer)); 
-        dump_private_measurement(video_sent, VAR_NAME(video_sent));
-        dump_private_measurement(video_acked, VAR_NAME(video_acked));
-        dump_public_measurement(video_size, VAR_NAME(video_size));
-        dump_public_measurement(ssim, VAR_NAME(ssim));
+    /* Dump each measurement to its own csv, running up to n_threads dumps at once
+     * (each only reads its finished tables, stream_ids, and the string tables).
+     * In two-pass mode, dumps run one at a time, since each shard is re-parsed into this Parser.
+     * If stream_stats is given, client_buffer events and video_sent chunks are also added to it;
+     * csvs are only written if write_csvs. Rows and bytes written are counted in the current metrics phase. */
+    void dump_all_measurements(const unsigned n_threads, const bool write_csvs, 
+                               StreamStats * const stream_stats) {
+        // largest first, so it starts right away
+        const vector<pair<Measurement, function<DumpTotals()>>> all_dumps = {
+            {Measurement::client_buffer, [&] { return dump_private_measurement(client_buffer, VAR_NAME(client_buffer), 
+                                                                               write_csvs, stream_stats); }},
+            {Measurement::video_sent, [&] { return dump_private_measurement(video_sent, VAR_NAME(video_sent),
+                                                                            write_csvs, stream_stats); }},
+            {Measurement::video_acked, [&] { return dump_private_measurement(video_acked, VAR_NAME(video_acked),
+                                                                             write_csvs, nullptr); }},
+            {Measurement::video_size, [&] { return dump_public_measurement(video_size, VAR_NAME(video_size)); }},
+            {Measurement::ssim, [&] { return dump_public_measurement(ssim, VAR_NAME(ssim)); }}
+        };
+        // only dump measurements that were parsed, and are written or summarized
+        vector<function<DumpTotals()>> dumps;
+        for (const auto & [measurement, dump] : all_dumps) {
+            const bool summarized = stream_stats and (measurement == Measurement::client_buffer 
+                                                      or measurement == Measurement::video_sent);
+            if (not parsed_measurements[size_t(measurement)] or not (write_csvs or summarized)) {
+                continue;
+            }
+            if (stream_stats and measurement == Measurement::video_sent) {
+                /* stream_stats isn't thread-safe, and takes all events before any chunks 
+                 * (the order csv_to_stream_stats reads them in), so run after client_buffer's dump */
+                dumps.back() = [client_buffer_dump = dumps.back(), dump] {
+                    const DumpTotals client_buffer_totals = client_buffer_dump();
+                    const DumpTotals video_sent_totals = dump();
+                    return DumpTotals{client_buffer_totals.rows + video_sent_totals.rows,
+                                      client_buffer_totals.bytes + video_sent_totals.bytes};
+                };
+                continue;
+            }
+            dumps.emplace_back(dump);
+        }
+
+        /* In two-pass mode, every dump re-parses its shards into this Parser (its parse_line() scratch
+         * space, shard_line_no, and loaded_shards), so dumps must run one at a time.
+         * (load_shard()'s diagnostics suppression doesn't depend on this: it only covers its own thread.) */
+        const unsigned n_workers = spiller ? 1 : min<size_t>(n_threads, dumps.size());
+        // split the threads among the dumps running at once
+        csv_zstd_threads = max(n_threads / max(n_workers, 1U), 1U);
+        // each dump's totals, counted once all are done
+        vector<DumpTotals> dump_totals(dumps.size());
+        if (n_workers <= 1) {
+            for (size_t i = 0; i < dumps.size(); i++) {
+                dump_totals[i] = dumps[i]();
+            }
+        } else {
+            atomic<size_t> next_dump{0};
+            vector<exception_ptr> dump_errors(dumps.size());
+            vector<thread> workers;
+            for (unsigned w = 0; w < n_workers; w++) {
+                workers.emplace_back([&] {
+                    for (size_t i = next_dump++; i < dumps.size(); i = next_dump++) {
+                        try {
+                            dump_totals[i] = dumps[i]();
+                        } catch (...) {
+                            dump_errors[i] = current_exception();
+                        }
+                    }
+                });
+            }
+            for (auto & worker : workers) {
+                worker.join();
+            }
+            for (const auto & dump_error : dump_errors) {
+                if (dump_error) {
+                    rethrow_exception(dump_error);
+                }
+            }
+        }
+
+        for (const auto & [rows, bytes] : dump_totals) {
+            metrics().count(rows, bytes);
+        }
     }
 
     /* Parse lines of influxDB export, for lines measuring 
@@ -637,155 +1180,471 @@ private:
      * Store that field in the appropriate Event, SysInfo, VideoSent, or VideoAcked (which may already
      * be partially populated by other lines) in client_buffer, client_sysinfo, video_sent, or video_acked
      * data structures. 
-     * Ignore data points out of the date range. */
+     * Ignore data points out of the date range. 
+     * A reader thread reads stdin ahead of parsing, in blocks of lines passed through a LineRing,
+     * so the exporter writing to stdin only waits when the ring is full.
+     * (Lines are parsed on this thread alone, since ids are interned and shards spilled in line order.) */
     void parse_stdin() {
-        ios::sync_with_stdio(false);
-        string line_storage;
+        LineRing ring{LINE_RING_SLOTS};
+        uint64_t n_bytes = 0;
+        exception_ptr read_error;
+        thread reader([&] {
+            try {
+                n_bytes = read_lines_into(STDIN_FILENO, ring);
+            } catch (...) {
+                read_error = current_exception();
+            }
+            ring.close();
+        });
 
         unsigned int line_no = 0;
+        try {
+            for (const LineBlock * block; (block = ring.consumer_block()); ring.pop()) {
+                for_each_line(block->lines(), [&](const string_view line) {
+                    if (line_no % 1000000 == 0) {
+                        const size_t rss = memcheck() / 1024;
+                        cerr << "line " << line_no / 1000000 << "M, RSS=" << rss << " MiB\n"; 
+                    }
+                    line_no++;
+
+                    parse_line(line, line_no);
+                });
+            }
+        } catch (...) {
+            ring.cancel();
+            reader.join();
+            throw;
+        }
+        reader.join();
+        if (read_error) {
+            rethrow_exception(read_error);
+        }
+
+        cerr << "Read " << n_bytes / (1 << 20) << " MiB of input in " << ring.n_blocks() << " blocks; "
+             << "reader waited for parsing " << ring.full_waits().n_waits << " times (" 
+             << ring.full_waits().seconds() << " s), "
+             << "parser waited for input " << ring.empty_waits().n_waits << " times (" 
+             << ring.empty_waits().seconds() << " s)\n";
+        metrics().count(line_no, n_bytes);
+
+        finish_parse();
+    }
+
+    /* Parse an influxDB export file (rather than stdin), splitting it into n_threads chunks
+     * that are parsed concurrently into per-chunk Parsers.
+     * The chunks are then merged in file order, so tables (including string table ids, which
+     * determine dump order) end up identical to those built by parse_stdin(). */
+    void parse_export_file(const string & export_filename, const unsigned n_threads) {
+        const MappedFile export_file{export_filename};
+        // chunk Parsers can't spill (shard files must be written in line order)
+        // (none, if the export is empty: then only finish_parse() runs)
+        const vector<string_view> chunks = export_file.split_lines(spilling ? 1 : n_threads);
+
+        // This Parser takes the first chunk, so its ids are already the final ones
+        vector<unique_ptr<Parser>> chunk_parsers;
+        for (unsigned i = 1; i < chunks.size(); i++) {
+            chunk_parsers.emplace_back(make_unique<Parser>(days.first, date_str));
+            chunk_parsers.back()->parse_only(parsed_measurements);
+        }
 
-        vector<string_view> fields, measurement_tag_set_fields, field_key_value;
+        vector<exception_ptr> chunk_errors(chunks.size());
+        vector<thread> workers;
+        for (unsigned i = 0; i < chunks.size(); i++) {
+            Parser & chunk_parser = i == 0 ? *this : *chunk_parsers.at(i - 1);
+            workers.emplace_back([&chunk_parser, &chunk = chunks[i], &chunk_error = chunk_errors[i]] {
+                try {
+                    chunk_parser.parse_chunk(chunk);
+                } catch (...) {
+                    chunk_error = current_exception();
+                }
+            });
+        }
+        for (auto & worker : workers) {
+            worker.join();
+        }
+        for (const auto & chunk_error : chunk_errors) {
+            if (chunk_error) {
+                rethrow_exception(chunk_error);
+            }
+        }
+        uint64_t n_lines = n_chunk_lines;
+        for (const auto & chunk_parser : chunk_parsers) {
+            n_lines += chunk_parser->n_chunk_lines;
+        }
+        metrics().count(n_lines, export_file.contents().size());
+
+        for (auto & chunk_parser : chunk_parsers) {
+            merge_parser(*chunk_parser);
+            chunk_parser.reset();   // free as we go
+        }
+        finish_parse();
+    }
 
-        while (cin.good()) {
+    private:
+
+    /* Scratch space for parse_line() (per Parser, so chunks can be parsed concurrently) */
+    vector<string_view> fields{}, measurement_tag_set_fields{}, field_key_value{};
+
+    // lines in the chunk given to parse_chunk()
+    uint64_t n_chunk_lines = 0;
+
+    /* Parse each line of a chunk of the export (line_no is relative to the chunk) */
+    void parse_chunk(const string_view chunk) {
+        unsigned int line_no = 0;
+        for_each_line(chunk, [&](const string_view line) {
             if (line_no % 1000000 == 0) {
                 const size_t rss = memcheck() / 1024;
                 cerr << "line " << line_no / 1000000 << "M, RSS=" << rss << " MiB\n"; 
             }
-
-            getline(cin, line_storage);
             line_no++;
 
-            const string_view line{line_storage};
-
-            if (line.empty() or line.front() == '#') {
-                continue;
-            }
+            parse_line(line, line_no);
+        });
+        n_chunk_lines = line_no;
+        finalize_tables();
+    }
 
-            if (line.size() > numeric_limits<uint8_t>::max()) {
-                throw runtime_error("Line " + to_string(line_no) + " too long");
-            }
+    /* Parse one line of the export (see parse_stdin()) */
+    void parse_line(const string_view line, const unsigned int line_no) {
+        if (line.empty() or line.front() == '#') {
+            return;
+        }
 
-            // influxDB export line has 3 space-separated fields
-            // e.g. client_buffer,channel=abc,server_id=1 cum_rebuf=2.183 1546379215825000000
-            split_on_char(line, ' ', fields);
-            if (fields.size() != 3) {
-                if (not line.compare(0, 15, "CREATE DATABASE"sv)) {
-                    continue;
-                }
+        if (line.size() > numeric_limits<uint8_t>::max()) {
+            throw runtime_error("Line " + to_string(line_no) + " too long");
+        }
 
-                cerr << "Ignoring line with wrong number of fields: " << string(line) << "\n";
-                continue;
-            }
-            const auto [measurement_tag_set, field_set, timestamp_str] = tie(fields[0], fields[1], fields[2]);
-            // e.g. ["client_buffer,channel=abc,server_id=1", "cum_rebuf=2.183", "1546379215825000000"]
+        // Classify the measurement by the line's prefix (up to the first tag or the field set), 
+        // so skipped measurements cost no splitting or number parsing.
+        // Unknown names are diagnosed below.
+        const Measurement measurement = Measurement(measurements(line.substr(0, line.find_first_of(", "))));
+        if (measurement != Measurement::unknown and not parsed_measurements[size_t(measurement)]) {
+            n_skipped_lines[size_t(measurement)]++;
+            return;
+        }
 
-            // skip out-of-range data points
-            const uint64_t timestamp{to_uint64(timestamp_str)};
-            if (timestamp < days.first or timestamp > days.second) {
-                n_bad_ts++;
-                continue;
+        // influxDB export line has 3 space-separated fields
+        // e.g. client_buffer,channel=abc,server_id=1 cum_rebuf=2.183 1546379215825000000
+        split_on_char(line, ' ', fields);
+        if (fields.size() != 3) {
+            if (not line.compare(0, 15, "CREATE DATABASE"sv)) {
+                return;
             }
 
-            split_on_char(measurement_tag_set, ',', measurement_tag_set_fields);
-            if (measurement_tag_set_fields.empty()) {
-                throw runtime_error("No measurement field on line " + to_string(line_no));
-            }
-            const auto measurement = measurement_tag_set_fields[0]; // e.g. client_buffer
+            diagnostics().report("line_with_wrong_field_count", [&](ostream & out) {
+                out << "Ignoring line with wrong number of fields: " << line << "\n";
+            });
+            return;
+        }
+        const auto [measurement_tag_set, field_set, timestamp_str] = tie(fields[0], fields[1], fields[2]);
+        // e.g. ["client_buffer,channel=abc,server_id=1", "cum_rebuf=2.183", "1546379215825000000"]
+
+        // skip out-of-range data points
+        const uint64_t timestamp{to_uint64(timestamp_str)};
+        if (timestamp < days.first or timestamp > days.second) {
+            n_bad_ts++;
+            return;
+        }
 
-            split_on_char(field_set, '=', field_key_value);          
-            if (field_key_value.size() != 2) {
-                throw runtime_error("Irregular number of fields in field set: " + string(line));
-            }
+        split_on_char(measurement_tag_set, ',', measurement_tag_set_fields);
+        if (measurement_tag_set_fields.empty()) {
+            throw runtime_error("No measurement field on line " + to_string(line_no));
+        }
 
-            const auto [key, value] = tie(field_key_value[0], field_key_value[1]);  // e.g. [cum_rebuf, 2.183]
+        split_on_char(field_set, '=', field_key_value);          
+        if (field_key_value.size() != 2) {
+            throw runtime_error("Irregular number of fields in field set: " + string(line));
+        }
 
-            try {
-                if ( measurement == "client_buffer"sv ) {
-                    /* Set this line's field in the Event/VideoSent/VideoAcked corresponding to this 
-                     * server, channel, and ts. 
-                     * If two events share a {timestamp, server_id, channel}, 
-                     * Event will become contradictory and we'll record it as "bad" later
-                     * (bad events do occur during study period, e.g. 2019-07-02) */
-                    const uint64_t server_id = get_server_id(measurement_tag_set_fields);
-                    const uint8_t channel_id = get_dynamic_tag_id(client_buffer.at(server_id), 
-                                                                  measurement_tag_set_fields, 
-                                                                  "channel"sv);
+        const auto [key, value] = tie(field_key_value[0], field_key_value[1]);  // e.g. [cum_rebuf, 2.183]
+
+        try {
+            switch (measurement) {
+            case Measurement::client_buffer: {
+                /* Set this line's field in the Event/VideoSent/VideoAcked corresponding to this 
+                 * server, channel, and ts. 
+                 * If two events share a {timestamp, server_id, channel}, 
+                 * Event will become contradictory and we'll record it as "bad" later
+                 * (bad events do occur during study period, e.g. 2019-07-02) */
+                const uint64_t server_id = get_server_id(measurement_tag_set_fields);
+                const uint8_t channel_id = get_dynamic_tag_id(client_buffer.at(server_id), 
+                                                              measurement_tag_set_fields, 
+                                                              "channel"sv);
+                if (spilling) {
+                    spill_line({"client_buffer"sv, server_id, channel_id}, key, value, line);
+                } else {
                     client_buffer[server_id].at(channel_id)[timestamp].insert_unique(key, value, usernames);
-                } else if ( measurement == "active_streams"sv ) {
-                    // skip
-                } else if ( measurement == "backlog"sv ) {
-                    // skip
-                } else if ( measurement == "channel_status"sv ) {
-                    // skip
-                } else if ( measurement == "client_error"sv ) {
-                    // skip
-                } else if ( measurement == "client_sysinfo"sv ) {
-                    // some records in 2019-09-08T11_2019-09-09T11 have a crazy server_id and
-                    // seemingly the older record structure (with user= as part of the tags)
-                    optional<uint64_t> server_id;
-                    try {
-                        server_id.emplace(get_server_id(measurement_tag_set_fields));
-                    } catch (const exception & e) {
-                        cerr << "Error with server_id: " << e.what() << "\n";
-                    }
+                }
+                break;
+            }
+            case Measurement::active_streams:
+            case Measurement::backlog:
+            case Measurement::channel_status:
+            case Measurement::client_error:
+            case Measurement::decoder_info:
+            case Measurement::server_info:
+                // never parsed (skipped above)
+                break;
+            case Measurement::client_sysinfo: {
+                // some records in 2019-09-08T11_2019-09-09T11 have a crazy server_id and
+                // seemingly the older record structure (with user= as part of the tags)
+                optional<uint64_t> server_id;
+                try {
+                    server_id.emplace(get_server_id(measurement_tag_set_fields));
+                } catch (const exception & e) {
+                    cerr << "Error with server_id: " << e.what() << "\n";
+                }
 
-                    // Set this line's field (e.g. browser) in the SysInfo corresponding to this 
-                    // server and ts
-                    if (server_id.has_value()) {
-                        client_sysinfo[server_id.value()][timestamp].insert_unique(key, value, usernames, browsers, ostable);
-                    }
-                } else if ( measurement == "decoder_info"sv ) {
-                    // skip
-                } else if ( measurement == "server_info"sv ) {
-                    // skip
-                } else if ( measurement == "ssim"sv ) {
-                    const uint8_t format_id = get_dynamic_tag_id(ssim,
-                                                                 measurement_tag_set_fields, 
-                                                                 "format"sv);
-                    const uint8_t channel_id = get_dynamic_tag_id(ssim.at(format_id),
-                                                                  measurement_tag_set_fields, 
-                                                                  "channel"sv);
+                // Set this line's field (e.g. browser) in the SysInfo corresponding to this 
+                // server and ts
+                if (server_id.has_value()) {
+                    client_sysinfo[server_id.value()][timestamp].insert_unique(key, value, usernames, browsers, ostable);
+                }
+                break;
+            }
+            case Measurement::ssim: {
+                const uint8_t format_id = get_dynamic_tag_id(ssim,
+                                                             measurement_tag_set_fields, 
+                                                             "format"sv);
+                const uint8_t channel_id = get_dynamic_tag_id(ssim.at(format_id),
+                                                              measurement_tag_set_fields, 
+                                                              "channel"sv);
+                if (spilling) {
+                    spill_line({"ssim"sv, format_id, channel_id}, key, value, line);
+                } else {
                     ssim.at(format_id).at(channel_id)[timestamp].insert_unique(key, value);
-                } else if ( measurement == "video_acked"sv ) {
-                    const uint64_t server_id = get_server_id(measurement_tag_set_fields);
-                    const uint8_t channel_id = get_dynamic_tag_id(video_acked.at(server_id), 
-                                                                  measurement_tag_set_fields, 
-                                                                  "channel"sv);
+                }
+                break;
+            }
+            case Measurement::video_acked: {
+                const uint64_t server_id = get_server_id(measurement_tag_set_fields);
+                const uint8_t channel_id = get_dynamic_tag_id(video_acked.at(server_id), 
+                                                              measurement_tag_set_fields, 
+                                                              "channel"sv);
+                if (spilling) {
+                    spill_line({"video_acked"sv, server_id, channel_id}, key, value, line);
+                } else {
                     video_acked[server_id].at(channel_id)[timestamp].insert_unique(key, value, usernames);
-                } else if ( measurement == "video_sent"sv ) {
-                    const uint64_t server_id = get_server_id(measurement_tag_set_fields);
-                    const uint8_t channel_id = get_dynamic_tag_id(video_sent.at(server_id), 
-                                                                  measurement_tag_set_fields, 
-                                                                  "channel"sv);
+                }
+                break;
+            }
+            case Measurement::video_sent: {
+                const uint64_t server_id = get_server_id(measurement_tag_set_fields);
+                const uint8_t channel_id = get_dynamic_tag_id(video_sent.at(server_id), 
+                                                              measurement_tag_set_fields, 
+                                                              "channel"sv);
+                if (spilling) {
+                    spill_line({"video_sent"sv, server_id, channel_id}, key, value, line);
+                } else {
                     video_sent[server_id].at(channel_id)[timestamp].insert_unique(key, value, usernames, formats);
-                } else if ( measurement == "video_size"sv ) {
-                    const uint8_t format_id = get_dynamic_tag_id(video_size,
-                                                                 measurement_tag_set_fields, 
-                                                                 "format"sv);
-                    const uint8_t channel_id = get_dynamic_tag_id(video_size.at(format_id),
-                                                                  measurement_tag_set_fields, 
-                                                                  "channel"sv);
-                    video_size.at(format_id).at(channel_id)[timestamp].insert_unique(key, value);
+                }
+                break;
+            }
+            case Measurement::video_size: {
+                const uint8_t format_id = get_dynamic_tag_id(video_size,
+                                                             measurement_tag_set_fields, 
+                                                             "format"sv);
+                const uint8_t channel_id = get_dynamic_tag_id(video_size.at(format_id),
+                                                              measurement_tag_set_fields, 
+                                                              "channel"sv);
+                if (spilling) {
+                    spill_line({"video_size"sv, format_id, channel_id}, key, value, line);
                 } else {
-                    throw runtime_error( "Can't parse: " + string(line) );
+                    video_size.at(format_id).at(channel_id)[timestamp].insert_unique(key, value);
                 }
-            } catch (const exception & e ) {
-                cerr << "Failure on line: " << line << "\n";
-                throw;
+                break;
+            }
+            default:
+                throw runtime_error( "Can't parse: " + string(line) );
+            }
+        } catch (const exception & e ) {
+            cerr << "Failure on line: " << line << "\n";
+            throw;
+        }
+    }
+
+    /* End of (first pass of) parsing */
+    void finish_parse() {
+        if (spilling) {
+            spiller->flush_all();
+            spilling = false;
+        }
+        finalize_tables();
+
+        for (size_t m = 0; m < N_MEASUREMENTS; m++) {
+            if (n_skipped_lines[m] > 0) {
+                cerr << "Skipped " << n_skipped_lines[m] << " " << measurements.name(m) << " lines\n";
+            }
+        }
+    }
+
+    /* Sort and coalesce every measurement table (see timestamp_table) */
+    void finalize_tables() {
+        const auto finalize_all = [](auto & table_vecs) {
+            for (auto & table_vec : table_vecs) {
+                for (auto & table : table_vec) {
+                    table.finalize();
+                }
+            }
+        };
+        finalize_all(client_buffer);
+        finalize_all(video_sent);
+        finalize_all(video_acked);
+        finalize_all(video_size);
+        finalize_all(ssim);
+        for (auto & table : client_sysinfo) {
+            table.finalize();
+        }
+
+        const size_t rss = memcheck() / 1024;
+        cerr << "finalized tables, RSS=" << rss << " MiB\n";
+    }
+
+    /* Map each id in a chunk's string table to the id of the same string in ours,
+     * adding strings we haven't seen in their chunk-local first-seen order. */
+    static vector<uint32_t> merge_string_table(string_table & table, const string_table & chunk_table) {
+        vector<uint32_t> id_map(chunk_table.size());
+        for (uint32_t chunk_id = 0; chunk_id < chunk_table.size(); chunk_id++) {
+            id_map[chunk_id] = table.forward_map_vivify(chunk_table.reverse_map(chunk_id));
+        }
+        return id_map;
+    }
+
+    static void remap_id(optional<uint32_t> & id, const vector<uint32_t> & id_map) {
+        if (id.has_value()) {
+            id.emplace(id_map.at(id.value()));
+        }
+    }
+
+    /* Merge a chunk's timestamp_table into ours. Datapoints split across chunks are
+     * combined field by field (in finalize_tables()), as if the later chunk's lines had followed ours. */
+    template <typename Table, typename RemapIds>
+    static void merge_table(Table & table, Table & chunk_table, RemapIds remap_ids) {
+        for (auto & [ts, datapoint] : chunk_table) {
+            remap_ids(datapoint);
+        }
+        table.absorb(move(chunk_table));
+    }
+
+    /* Merge a vector<T_table> indexed by tag id (e.g. channel) into ours */
+    template <typename TableVec, typename RemapIds>
+    static void merge_tag_tables(TableVec & tables, TableVec & chunk_tables,
+                                 const vector<uint32_t> & tag_id_map, RemapIds remap_ids) {
+        for (uint32_t chunk_tag_id = 0; chunk_tag_id < chunk_tables.size(); chunk_tag_id++) {
+            if (chunk_tables[chunk_tag_id].empty()) {
+                continue;
+            }
+            const uint32_t tag_id = tag_id_map.at(chunk_tag_id);
+            if (tag_id >= tables.size()) {
+                tables.resize(tag_id + 1);
+            }
+            merge_table(tables[tag_id], chunk_tables[chunk_tag_id], remap_ids);
+        }
+    }
+
+    /* Merge the tables of a Parser that parsed a later chunk of the export into ours.
+     * Consumes chunk_parser's tables. */
+    void merge_parser(Parser & chunk_parser) {
+        const vector<uint32_t> username_ids = merge_string_table(usernames, chunk_parser.usernames);
+        const vector<uint32_t> browser_ids = merge_string_table(browsers, chunk_parser.browsers);
+        const vector<uint32_t> os_ids = merge_string_table(ostable, chunk_parser.ostable);
+        const vector<uint32_t> format_ids = merge_string_table(formats, chunk_parser.formats);
+        const vector<uint32_t> channel_ids = merge_string_table(channels, chunk_parser.channels);
+
+        const auto remap_user = [&](auto & datapoint) { datapoint.remap_user_id(username_ids); };
+        const auto remap_none = [](auto &) {};
+
+        for (uint64_t server = 0; server < SERVER_COUNT; server++) {
+            merge_tag_tables(client_buffer[server], chunk_parser.client_buffer[server], 
+                             channel_ids, remap_user);
+            merge_table(client_sysinfo[server], chunk_parser.client_sysinfo[server], 
+                        [&](Sysinfo & sysinfo) {
+                            remap_id(sysinfo.user_id, username_ids);
+                            remap_id(sysinfo.browser_id, browser_ids);
+                            remap_id(sysinfo.os, os_ids);
+                        });
+            merge_tag_tables(video_sent[server], chunk_parser.video_sent[server], 
+                             channel_ids, [&](VideoSent & video_sent) {
+                                 video_sent.remap_user_id(username_ids);
+                                 video_sent.remap_format(format_ids);
+                             });
+            merge_tag_tables(video_acked[server], chunk_parser.video_acked[server], 
+                             channel_ids, remap_user);
+        }
+
+        for (uint32_t chunk_format_id = 0; chunk_format_id < chunk_parser.video_size.size(); chunk_format_id++) {
+            // (vector is presized with N_FORMATS_ESTIMATE empty entries)
+            if (chunk_parser.video_size[chunk_format_id].empty()) {
+                continue;
+            }
+            const uint32_t format_id = format_ids.at(chunk_format_id);
+            if (format_id >= video_size.size()) {
+                video_size.resize(format_id + 1);
+            }
+            merge_tag_tables(video_size[format_id], chunk_parser.video_size[chunk_format_id],
+                             channel_ids, remap_none);
+        }
+        for (uint32_t chunk_format_id = 0; chunk_format_id < chunk_parser.ssim.size(); chunk_format_id++) {
+            // (vector is presized with N_FORMATS_ESTIMATE empty entries)
+            if (chunk_parser.ssim[chunk_format_id].empty()) {
+                continue;
+            }
+            const uint32_t format_id = format_ids.at(chunk_format_id);
+            if (format_id >= ssim.size()) {
+                ssim.resize(format_id + 1);
             }
+            merge_tag_tables(ssim[format_id], chunk_parser.ssim[chunk_format_id],
+                             channel_ids, remap_none);
+        }
+
+        n_bad_ts += chunk_parser.n_bad_ts;
+        for (size_t m = 0; m < N_MEASUREMENTS; m++) {
+            n_skipped_lines[m] += chunk_parser.n_skipped_lines[m];
         }
     }
 };  // end Parser
 
-void influx_to_csv_main(const string & date_str, Day_ns start_ts) {
+void influx_to_csv_main(const string & date_str, Day_ns start_ts,
+                        const string & export_filename, unsigned n_threads,
+                        const string & spill_dir, const optional<measurement_set> & selected,
+                        const string & experiment_dump_filename, const bool write_csvs,
+                        const string & columnar_filename, const bool compress_csvs) {
+    // read experimental settings up front, so a bad dump fails before parsing
+    optional<StreamStats> stream_stats;
+    if (not experiment_dump_filename.empty()) {
+        stream_stats.emplace(experiment_dump_filename);
+    }
+
     // use date_str to name csv
     Parser parser{ start_ts, date_str };
-    parser.parse_stdin();
+    if (selected) {
+        parser.parse_only(*selected);
+    }
+    if (not spill_dir.empty()) {
+        parser.spill_to(spill_dir);
+    }
+    if (compress_csvs) {
+        parser.compress_csvs();
+    }
+    metrics().start_phase("parse");
+    if (export_filename.empty()) {
+        parser.parse_stdin();
+    } else {
+        parser.parse_export_file(export_filename, n_threads);
+    }
+    metrics().start_phase("group");
     parser.group_stream_ids();
+    metrics().start_phase("anonymize");
     parser.anonymize_stream_ids(); 
+    parser.build_public_id_index();
     // parser.check_public_stream_id_uniqueness(); // remove (test only)
-    parser.dump_all_measurements();
+    metrics().start_phase("dump");
+    parser.dump_all_measurements(n_threads, write_csvs, stream_stats ? &*stream_stats : nullptr);
     // TODO: also dump sysinfo?
+    if (stream_stats) {
+        metrics().start_phase("summarize");
+        stream_stats->analyze_streams(n_threads, columnar_filename);
+    }
 }
 
 void consume_cin() {
@@ -794,33 +1653,162 @@ void consume_cin() {
     while (cin.good()) { getline(cin, line_storage); }
 }
 
+void print_usage(const string & program) {
+    cerr << "Usage: " << program << " [--export-file <export_filename> [--threads <n>]]"
+            " [--spill-dir <dir>] [--measurements <list>]"
+            " [--stream-stats <expt_dump> [--no-csv] [--columnar-out <filename>]] [--compress] [--verbose]"
+            " [--metrics-out <metrics_filename>]"
+            " date [e.g. 2019-07-01T11_2019-07-02T11]\n"
+            "export_filename: influxDB export to parse (with mmap, in parallel), instead of stdin.\n"
+            "threads: number of chunks to parse, and measurements to dump, concurrently (default: number of CPUs).\n"
+            "dir: parse in two passes, spilling each server/channel shard to a temporary file in dir, "
+            "so memory use scales with the largest shard (export file is then parsed on one thread).\n"
+            "list: comma-separated measurements to parse and dump, e.g. client_buffer,video_sent "
+            "(default: client_buffer,client_sysinfo,ssim,video_acked,video_sent,video_size); "
+            "lines of other measurements are skipped unparsed.\n"
+            "expt_dump: experimental settings [from postgres]; also summarize each stream to stdout, "
+            "as csv_to_stream_stats would from the written csvs (requires client_buffer and video_sent).\n"
+            "no-csv: only summarize streams, without writing csvs "
+            "(default list is then client_buffer,video_sent).\n"
+            "filename: write stream summaries to filename as a columnar table, instead of "
+            "to stdout as text (totals are still written to stdout).\n"
+            "compress: write csvs zstd-compressed, as <measurement>_<date>.csv.zst "
+            "(compressed on all threads, in independent frames).\n"
+            "verbose: print every anomalous record (contradictory value, datapoint or chunk without "
+            "a stream, malformed line) to stderr as it occurs; by default each kind is only counted, "
+            "with a few examples, in the JSON summary written to stderr at exit.\n"
+            "metrics_filename: write wall and CPU time, throughput, peak RSS, and allocator statistics "
+            "of each phase (parse, group, anonymize, dump, summarize) to metrics_filename as JSON.\n";
+}
+
 /* Must take date as argument, to filter out extra data from influx export */
 int main(int argc, char *argv[]) {
+    // stdin is only consumed (to avoid stalling the exporter) when reading from it
+    string export_filename;
+    const auto consume_input = [&export_filename] {
+        if (export_filename.empty()) {
+            consume_cin();
+        }
+    };
+
     try {
         if (argc <= 0) {
             abort();
         }
 
-        if (argc != 2) {
-            cerr << "Usage: " << argv[0] << " date [e.g. 2019-07-01T11_2019-07-02T11]\n";
-            consume_cin();
+        const option opts[] = {
+            {"export-file", required_argument, nullptr, 'f'},
+            {"threads", required_argument, nullptr, 't'},
+            {"spill-dir", required_argument, nullptr, 'd'},
+            {"measurements", required_argument, nullptr, 'm'},
+            {"stream-stats", required_argument, nullptr, 's'},
+            {"no-csv", no_argument, nullptr, 'n'},
+            {"columnar-out", required_argument, nullptr, 'c'},
+            {"compress", no_argument, nullptr, 'z'},
+            {"verbose", no_argument, nullptr, 'v'},
+            {"metrics-out", required_argument, nullptr, 'o'},
+            {nullptr, 0, nullptr, 0}
+        };
+        unsigned n_threads = max(thread::hardware_concurrency(), 1U);
+        string spill_dir;
+        optional<measurement_set> selected;
+        string experiment_dump_filename;
+        bool write_csvs = true;
+        string columnar_filename;
+        bool compress_csvs = false;
+        string metrics_filename;
+
+        while (true) {
+            const int opt = getopt_long(argc, argv, "f:t:d:m:s:nc:zvo:", opts, nullptr);
+            if (opt == -1) break;
+            switch (opt) {
+                case 'f':
+                    export_filename = optarg;
+                    break;
+                case 't':
+                    n_threads = to_uint64(optarg);
+                    if (n_threads == 0) {
+                        cerr << "Error: Number of threads must be positive\n\n";
+                        print_usage(argv[0]);
+                        consume_input();
+                        return EXIT_FAILURE;
+                    }
+                    break;
+                case 'd':
+                    spill_dir = optarg;
+                    break;
+                case 'm':
+                    selected = parse_measurement_list(optarg);
+                    break;
+                case 's':
+                    experiment_dump_filename = optarg;
+                    break;
+                case 'n':
+                    write_csvs = false;
+                    break;
+                case 'c':
+                    columnar_filename = optarg;
+                    break;
+                case 'z':
+                    compress_csvs = true;
+                    break;
+                case 'v':
+                    diagnostics().set_verbose(true);
+                    break;
+                case 'o':
+                    metrics_filename = optarg;
+                    break;
+                default:
+                    print_usage(argv[0]);
+                    consume_input();
+                    return EXIT_FAILURE;
+            }
+        }
+
+        if (optind != argc - 1) {
+            print_usage(argv[0]);
+            consume_input();
             return EXIT_FAILURE;
         }
 
-        optional<Day_sec> start_ts = str2Day_sec(argv[1]);
+        if (not write_csvs) {
+            if (experiment_dump_filename.empty()) {
+                throw runtime_error("--no-csv requires --stream-stats");
+            }
+            if (not selected) {
+                selected = parse_measurement_list("client_buffer,video_sent");
+            }
+        }
+        if (not columnar_filename.empty() and experiment_dump_filename.empty()) {
+            throw runtime_error("--columnar-out requires --stream-stats");
+        }
+        if (not experiment_dump_filename.empty() and selected
+                and not ((*selected)[size_t(Measurement::client_buffer)] 
+                         and (*selected)[size_t(Measurement::video_sent)])) {
+            throw runtime_error("--stream-stats requires client_buffer and video_sent");
+        }
+
+        optional<Day_sec> start_ts = str2Day_sec(argv[optind]);
         if (not start_ts) {
             cerr << "Date argument could not be parsed; format as 2019-07-01T11_2019-07-02T11\n";
-            consume_cin();
+            consume_input();
             return EXIT_FAILURE;
         }
 
         // convert start_ts to ns for comparison against Influx ts
-        influx_to_csv_main(argv[1], start_ts.value() * NS_PER_SEC); 
+        influx_to_csv_main(argv[optind], start_ts.value() * NS_PER_SEC, export_filename, n_threads,
+                           spill_dir, selected, experiment_dump_filename, write_csvs,
+                           columnar_filename, compress_csvs); 
+        if (not metrics_filename.empty()) {
+            metrics().write(metrics_filename, "influx_to_csv");
+        }
     } catch (const exception & e) {
         cerr << e.what() << "\n";
-        consume_cin();
+        diagnostics().write_summary(cerr, "influx_to_csv");
+        consume_input();
         return EXIT_FAILURE;
     }
-    consume_cin();
+    diagnostics().write_summary(cerr, "influx_to_csv");
+    consume_input();
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,149 @@
+/* Per-phase timing, throughput, and memory metrics of a run, reported as JSON (--metrics-out) */
+
+#ifndef METRICSUTIL_HH
+#define METRICSUTIL_HH
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <jemalloc/jemalloc.h>
+#include <jsoncpp/json/json.h>
+
+/* Current jemalloc statistics, in bytes (refreshed first); empty if jemalloc keeps no statistics */
+Json::Value allocator_stats() {
+    Json::Value stats{Json::objectValue};
+    uint64_t epoch = 1;
+    size_t epoch_len = sizeof(epoch);
+    if (mallctl("epoch", &epoch, &epoch_len, &epoch, epoch_len) != 0) {
+        return stats;
+    }
+    for (const std::string name : {"allocated", "active", "metadata", "resident", "mapped", "retained"}) {
+        size_t value = 0;
+        size_t value_len = sizeof(value);
+        if (mallctl(("stats." + name).c_str(), &value, &value_len, nullptr, 0) == 0) {
+            stats[name] = Json::UInt64(value);
+        }
+    }
+    return stats;
+}
+
+/* Consecutive phases of a run (e.g. parse, then dump), each lasting from its start_phase()
+ * to the next one (or to write()). Each phase records wall and CPU time (of all threads),
+ * the lines and bytes it counted (as totals and per second of wall time),
+ * peak RSS so far, and allocator statistics at its end. Not thread-safe. */
+class RunMetrics {
+    using clock = std::chrono::steady_clock;
+
+    struct Phase {
+        std::string name;
+        clock::time_point start;
+        double start_cpu_s;
+        double wall_s = 0, cpu_s = 0;
+        uint64_t lines = 0, bytes = 0;
+        bool counted = false;       // count() was called (perhaps with zero lines)
+        long peak_rss_kib = 0;
+        Json::Value allocator{};
+    };
+
+    clock::time_point run_start_ = clock::now();
+    std::vector<Phase> phases_{};
+    bool in_phase_ = false;
+
+    static double seconds(const timeval & time) { return time.tv_sec + time.tv_usec / 1e6; }
+
+    static rusage usage() {
+        rusage usage{};
+        if (getrusage(RUSAGE_SELF, &usage) < 0) {
+            throw std::runtime_error(std::string("getrusage: ") + strerror(errno));
+        }
+        return usage;
+    }
+
+    static double cpu_seconds() {
+        const rusage now = usage();
+        return seconds(now.ru_utime) + seconds(now.ru_stime);
+    }
+
+    void end_phase() {
+        if (not in_phase_) {
+            return;
+        }
+        Phase & phase = phases_.back();
+        phase.wall_s = std::chrono::duration<double>(clock::now() - phase.start).count();
+        phase.cpu_s = cpu_seconds() - phase.start_cpu_s;
+        phase.peak_rss_kib = usage().ru_maxrss;
+        phase.allocator = allocator_stats();
+        in_phase_ = false;
+    }
+
+    public:
+    /* End the current phase (if any), and start timing the next */
+    void start_phase(const std::string & name) {
+        end_phase();
+        phases_.push_back({name, clock::now(), cpu_seconds()});
+        in_phase_ = true;
+    }
+
+    /* Add lines and bytes processed to the current phase */
+    void count(const uint64_t lines, const uint64_t bytes) {
+        if (not in_phase_) {
+            throw std::runtime_error("metrics counted outside of a phase");
+        }
+        phases_.back().lines += lines;
+        phases_.back().bytes += bytes;
+        phases_.back().counted = true;
+    }
+
+    /* End the current phase, and write the run's metrics to filename */
+    void write(const std::string & filename, const std::string & program) {
+        end_phase();
+
+        Json::Value report{Json::objectValue};
+        report["program"] = program;
+        report["wall_s"] = std::chrono::duration<double>(clock::now() - run_start_).count();
+        report["cpu_s"] = cpu_seconds();
+        report["peak_rss_kib"] = Json::Int64(usage().ru_maxrss);
+        report["phases"] = Json::Value{Json::arrayValue};
+        for (const auto & phase : phases_) {
+            Json::Value & entry = report["phases"].append(Json::Value{Json::objectValue});
+            entry["name"] = phase.name;
+            entry["wall_s"] = phase.wall_s;
+            entry["cpu_s"] = phase.cpu_s;
+            if (phase.counted) {
+                entry["lines"] = Json::UInt64(phase.lines);
+                entry["bytes"] = Json::UInt64(phase.bytes);
+                entry["lines_per_s"] = phase.wall_s > 0 ? phase.lines / phase.wall_s : 0;
+                entry["bytes_per_s"] = phase.wall_s > 0 ? phase.bytes / phase.wall_s : 0;
+            }
+            entry["peak_rss_kib"] = Json::Int64(phase.peak_rss_kib);
+            entry["allocator"] = phase.allocator;
+        }
+        report["allocator"] = allocator_stats();
+
+        std::ofstream file{filename};
+        if (not file.is_open()) {
+            throw std::runtime_error("can't open " + filename);
+        }
+        file << report << "\n";
+        file.close();
+        if (file.bad()) {
+            throw std::runtime_error("error writing " + filename);
+        }
+    }
+};
+
+/* Metrics of the whole program */
+RunMetrics & metrics() {
+    static RunMetrics program_metrics;
+    return program_metrics;
+}
+
+#endif
@@ -0,0 +1,114 @@
+/* Memory-mapped input files */
+
+#ifndef MMAPUTIL_HH
+#define MMAPUTIL_HH
+
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Maps an entire file into memory, read-only. */
+class MappedFile {
+    std::string filename_;
+    char * data_ = nullptr;
+    size_t size_ = 0;
+
+    public:
+    explicit MappedFile(const std::string & filename) : filename_(filename) {
+        const int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("can't open " + filename + ": " + strerror(errno));
+        }
+
+        struct stat file_info{};
+        if (fstat(fd, &file_info) < 0) {
+            close(fd);
+            throw std::runtime_error("can't stat " + filename + ": " + strerror(errno));
+        }
+        size_ = file_info.st_size;
+
+        if (size_ > 0) {
+            void * const mapping = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error("can't mmap " + filename + ": " + strerror(errno));
+            }
+            data_ = static_cast<char *>(mapping);
+            // input is read front to back (per chunk)
+            madvise(data_, size_, MADV_SEQUENTIAL);
+        }
+        close(fd);
+    }
+
+    ~MappedFile() {
+        if (data_) {
+            munmap(data_, size_);
+        }
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile & operator=(const MappedFile &) = delete;
+
+    const std::string & filename() const { return filename_; }
+
+    std::string_view contents() const { return {data_, size_}; }
+
+    /* Drop the (unmodified) pages before pos from memory, e.g. once a
+     * front-to-back reader has passed them, so they stop counting toward RSS */
+    void release_before(const char * const pos) const {
+        const size_t page_size = sysconf(_SC_PAGESIZE);
+        const size_t length = (pos - data_) / page_size * page_size;
+        if (length > 0) {
+            madvise(data_, length, MADV_DONTNEED);
+        }
+    }
+
+    /* Split contents into (at most) n_chunks contiguous pieces of roughly equal size,
+     * each ending just after a newline (or at end of file), so no line spans two chunks. */
+    std::vector<std::string_view> split_lines(const unsigned n_chunks) const {
+        const std::string_view all = contents();
+        std::vector<std::string_view> chunks;
+
+        size_t chunk_start = 0;
+        for (unsigned i = 1; i <= n_chunks and chunk_start < all.size(); i++) {
+            size_t chunk_end = all.size();
+            if (i < n_chunks) {
+                const size_t target = all.size() / n_chunks * i;
+                if (target > chunk_start) {
+                    const size_t newline = all.find('\n', target);
+                    chunk_end = newline == all.npos ? all.size() : newline + 1;
+                } else {
+                    continue;   // chunk would be empty
+                }
+            }
+            chunks.emplace_back(all.substr(chunk_start, chunk_end - chunk_start));
+            chunk_start = chunk_end;
+        }
+
+        return chunks;
+    }
+};
+
+/* Call fn on each line in chunk (without trailing newline) */
+template <typename LineFn>
+void for_each_line(std::string_view chunk, LineFn fn) {
+    while (not chunk.empty()) {
+        const size_t newline = chunk.find('\n');
+        if (newline == chunk.npos) {
+            fn(chunk);
+            return;
+        }
+        fn(chunk.substr(0, newline));
+        chunk.remove_prefix(newline + 1);
+    }
+}
+
+#endif
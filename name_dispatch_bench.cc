@@ -0,0 +1,251 @@
+/* Benchmark of name_dispatch (analyzeutil.hh) against the if/else string-compare chains it replaced,
+ * on the measurement names, field keys, and event types of the lines of an Influx export.
+ * Both are timed on the same names (already split out of the lines, so only dispatch is timed),
+ * and must agree on every one. */
+
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "analyzeutil.hh"
+#include "mmaputil.hh"
+
+using namespace std;
+
+// Names on one line of the export (event is only set on event= lines)
+struct LineNames {
+    string_view measurement{}, key{}, event{};
+};
+
+// What a line's names dispatch to
+struct Dispatched {
+    Measurement measurement;
+    FieldKey key;
+    uint8_t event;
+
+    bool operator==(const Dispatched & other) const {
+        return measurement == other.measurement and key == other.key and event == other.event;
+    }
+};
+
+static constexpr uint8_t NO_EVENT = 0xff;
+
+/* Old dispatch: the chains in Parser::parse_line(), each insert_unique(), and EventType() */
+class CompareChains {
+    static Measurement measurement(const string_view name) {
+        if (name == "client_buffer"sv) { return Measurement::client_buffer; }
+        else if (name == "active_streams"sv) { return Measurement::active_streams; }
+        else if (name == "backlog"sv) { return Measurement::backlog; }
+        else if (name == "channel_status"sv) { return Measurement::channel_status; }
+        else if (name == "client_error"sv) { return Measurement::client_error; }
+        else if (name == "client_sysinfo"sv) { return Measurement::client_sysinfo; }
+        else if (name == "decoder_info"sv) { return Measurement::decoder_info; }
+        else if (name == "server_info"sv) { return Measurement::server_info; }
+        else if (name == "ssim"sv) { return Measurement::ssim; }
+        else if (name == "video_acked"sv) { return Measurement::video_acked; }
+        else if (name == "video_sent"sv) { return Measurement::video_sent; }
+        else if (name == "video_size"sv) { return Measurement::video_size; }
+        return Measurement::unknown;
+    }
+
+    static FieldKey event_key(const string_view key) {
+        if (key == "first_init_id"sv) { return FieldKey::first_init_id; }
+        else if (key == "init_id"sv) { return FieldKey::init_id; }
+        else if (key == "expt_id"sv) { return FieldKey::expt_id; }
+        else if (key == "user"sv) { return FieldKey::user; }
+        else if (key == "event"sv) { return FieldKey::event; }
+        else if (key == "buffer"sv) { return FieldKey::buffer; }
+        else if (key == "cum_rebuf"sv) { return FieldKey::cum_rebuf; }
+        return FieldKey::unknown;
+    }
+
+    static FieldKey sysinfo_key(const string_view key) {
+        if (key == "first_init_id"sv) { return FieldKey::first_init_id; }
+        else if (key == "init_id"sv) { return FieldKey::init_id; }
+        else if (key == "expt_id"sv) { return FieldKey::expt_id; }
+        else if (key == "user"sv) { return FieldKey::user; }
+        else if (key == "browser"sv) { return FieldKey::browser; }
+        else if (key == "os"sv) { return FieldKey::os; }
+        else if (key == "ip"sv) { return FieldKey::ip; }
+        else if (key == "screen_width"sv or key == "screen_height"sv) {
+            return key == "screen_width"sv ? FieldKey::screen_width : FieldKey::screen_height;
+        }
+        return FieldKey::unknown;
+    }
+
+    static FieldKey video_sent_key(const string_view key) {
+        if (key == "first_init_id"sv) { return FieldKey::first_init_id; }
+        else if (key == "init_id"sv) { return FieldKey::init_id; }
+        else if (key == "expt_id"sv) { return FieldKey::expt_id; }
+        else if (key == "user"sv) { return FieldKey::user; }
+        else if (key == "ssim_index"sv) { return FieldKey::ssim_index; }
+        else if (key == "delivery_rate"sv) { return FieldKey::delivery_rate; }
+        else if (key == "size"sv) { return FieldKey::size; }
+        else if (key == "video_ts"sv) { return FieldKey::video_ts; }
+        else if (key == "cwnd"sv) { return FieldKey::cwnd; }
+        else if (key == "in_flight"sv) { return FieldKey::in_flight; }
+        else if (key == "min_rtt"sv) { return FieldKey::min_rtt; }
+        else if (key == "rtt"sv) { return FieldKey::rtt; }
+        else if (key == "format"sv) { return FieldKey::format; }
+        else if (key == "buffer"sv) { return FieldKey::buffer; }
+        else if (key == "cum_rebuffer"sv) { return FieldKey::cum_rebuffer; }
+        return FieldKey::unknown;
+    }
+
+    static FieldKey video_acked_key(const string_view key) {
+        if (key == "first_init_id"sv) { return FieldKey::first_init_id; }
+        else if (key == "init_id"sv) { return FieldKey::init_id; }
+        else if (key == "expt_id"sv) { return FieldKey::expt_id; }
+        else if (key == "user"sv) { return FieldKey::user; }
+        else if (key == "video_ts"sv) { return FieldKey::video_ts; }
+        else if (key == "ssim_index"sv) { return FieldKey::ssim_index; }
+        else if (key == "buffer"sv) { return FieldKey::buffer; }
+        else if (key == "cum_rebuffer"sv) { return FieldKey::cum_rebuffer; }
+        return FieldKey::unknown;
+    }
+
+    static FieldKey video_size_key(const string_view key) {
+        if (key == "timestamp"sv) { return FieldKey::timestamp; }
+        else if (key == "size"sv) { return FieldKey::size; }
+        return FieldKey::unknown;
+    }
+
+    static FieldKey ssim_key(const string_view key) {
+        if (key == "timestamp"sv) { return FieldKey::timestamp; }
+        else if (key == "ssim_index"sv) { return FieldKey::ssim_index; }
+        return FieldKey::unknown;
+    }
+
+    static uint8_t event_type(const string_view type) {
+        using Type = Event::EventType::Type;
+        if (type == "timer"sv) { return uint8_t(Type::timer); }
+        else if (type == "play"sv) { return uint8_t(Type::play); }
+        else if (type == "rebuffer"sv) { return uint8_t(Type::rebuffer); }
+        else if (type == "init"sv) { return uint8_t(Type::init); }
+        else if (type == "startup"sv) { return uint8_t(Type::startup); }
+        return NO_EVENT;
+    }
+
+    public:
+    static Dispatched dispatch(const LineNames & names) {
+        Dispatched ret{measurement(names.measurement), FieldKey::unknown, NO_EVENT};
+        switch (ret.measurement) {
+        case Measurement::client_buffer:
+            ret.key = event_key(names.key);
+            if (ret.key == FieldKey::event) { ret.event = event_type(names.event); }
+            break;
+        case Measurement::client_sysinfo: ret.key = sysinfo_key(names.key); break;
+        case Measurement::video_sent: ret.key = video_sent_key(names.key); break;
+        case Measurement::video_acked: ret.key = video_acked_key(names.key); break;
+        case Measurement::video_size: ret.key = video_size_key(names.key); break;
+        case Measurement::ssim: ret.key = ssim_key(names.key); break;
+        default: break;
+        }
+        return ret;
+    }
+};
+
+/* New dispatch: one name_dispatch per name (each insert_unique() then switches on the key) */
+Dispatched hashed_dispatch(const LineNames & names) {
+    using EventType = Event::EventType;
+    Dispatched ret{Measurement(measurements(names.measurement)), FieldKey::unknown, NO_EVENT};
+    switch (ret.measurement) {
+    case Measurement::client_buffer: case Measurement::client_sysinfo: case Measurement::video_sent:
+    case Measurement::video_acked: case Measurement::video_size: case Measurement::ssim:
+        ret.key = to_field_key(names.key);
+        if (ret.key == FieldKey::event) {
+            const size_t type = EventType::types(names.event);
+            ret.event = type == EventType::names.size() ? NO_EVENT : type;
+        }
+        break;
+    default: break;
+    }
+    return ret;
+}
+
+/* Names on each data line of the export (skipping comments, DDL and DML) */
+vector<LineNames> read_names(const string & filename, const MappedFile & file) {
+    vector<LineNames> lines;
+    for_each_line(file.contents(), [&](const string_view line) {
+        const size_t space = line.find(' ');
+        if (line.empty() or line.front() == '#' or line.substr(0, 6) == "CREATE"sv or space == line.npos) {
+            return;
+        }
+        LineNames names;
+        names.measurement = line.substr(0, line.find_first_of(", "));
+        const string_view field = line.substr(space + 1, line.find(' ', space + 1) - space - 1);
+        const size_t equals = field.find('=');
+        names.key = field.substr(0, equals);
+        if (names.key == "event"sv and equals != field.npos and field.size() >= equals + 3) {
+            names.event = field.substr(equals + 2, field.size() - equals - 3);   // unquoted
+        }
+        lines.emplace_back(names);
+    });
+    if (lines.empty()) {
+        throw runtime_error(filename + ": no data lines");
+    }
+    return lines;
+}
+
+/* Fastest of repetitions runs of dispatch over lines, in seconds; sums the results so none is dropped */
+template <typename Dispatch>
+double time_dispatch(const vector<LineNames> & lines, const unsigned repetitions, Dispatch dispatch) {
+    double best_s = 1e9;
+    uint64_t sum = 0;
+    for (unsigned rep = 0; rep < repetitions; rep++) {
+        const auto start = chrono::steady_clock::now();
+        for (const auto & names : lines) {
+            const Dispatched d = dispatch(names);
+            sum += uint8_t(d.measurement) + uint8_t(d.key) + d.event;
+        }
+        best_s = min(best_s, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+    }
+    if (sum == 0) {
+        cerr << "(empty sum)\n";
+    }
+    return best_s;
+}
+
+void name_dispatch_bench(const string & filename, const unsigned repetitions) {
+    const MappedFile file(filename);
+    const vector<LineNames> lines = read_names(filename, file);
+
+    uint64_t n_unknown = 0;
+    for (const auto & names : lines) {
+        const Dispatched old_result = CompareChains::dispatch(names);
+        if (not (old_result == hashed_dispatch(names))) {
+            throw runtime_error("dispatch disagrees on: " + string(names.measurement) + " " + string(names.key));
+        }
+        n_unknown += old_result.measurement == Measurement::unknown;
+    }
+
+    const double chains_s = time_dispatch(lines, repetitions, CompareChains::dispatch);
+    const double hashed_s = time_dispatch(lines, repetitions, hashed_dispatch);
+
+    cout << fixed << setprecision(1) << lines.size() << " lines (" << n_unknown << " unknown measurements), "
+         << "best of " << repetitions << ":\n"
+         << "  compare chains: " << chains_s * 1e9 / lines.size() << " ns/line, "
+         << lines.size() / chains_s / 1e6 << " Mlines/s\n"
+         << "  name_dispatch:  " << hashed_s * 1e9 / lines.size() << " ns/line, "
+         << lines.size() / hashed_s / 1e6 << " Mlines/s\n"
+         << setprecision(2) << "  speedup: " << chains_s / hashed_s << "x\n";
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 1) {
+        abort();
+    }
+    if (argc != 2 and argc != 3) {
+        cerr << "Usage: " << argv[0] << " influx_export [repetitions]\n";
+        return EXIT_FAILURE;
+    }
+    try {
+        name_dispatch_bench(argv[1], argc == 3 ? stoul(argv[2]) : 10);
+    } catch (const exception & e) {
+        cerr << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,181 @@
+/* Reading piped input on its own thread, through a lock-free ring of line blocks */
+
+#ifndef PIPEUTIL_HH
+#define PIPEUTIL_HH
+
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+#include <unistd.h>
+
+// Bytes read into each block (a block holds whole lines, so may be grown to fit a longer line)
+static constexpr size_t LINE_BLOCK_SIZE = 1 << 20;
+// Blocks read ahead of the consumer, at most
+static constexpr size_t LINE_RING_SLOTS = 16;
+
+/* Whole lines read from input, in a reusable buffer */
+struct LineBlock {
+    std::string buffer{};
+    size_t size = 0;
+
+    std::string_view lines() const { return {buffer.data(), size}; }
+};
+
+/* Waits by one side of a LineRing, for a slot to become free (producer) or filled (consumer) */
+struct RingWaits {
+    size_t n_waits = 0;
+    std::chrono::steady_clock::duration time{};
+
+    double seconds() const { return std::chrono::duration<double>(time).count(); }
+};
+
+/* Fixed-size single-producer, single-consumer ring of LineBlocks.
+ * The producer fills the block returned by producer_block() and publishes it with push(),
+ * then calls close() after the last one; the consumer reads the block returned by consumer_block()
+ * and frees it with pop(). No locks are taken: a side only waits (yielding, then sleeping) while
+ * the ring is full or empty, and records those waits, which measure backpressure. */
+class LineRing {
+    std::vector<LineBlock> slots_;
+    alignas(64) std::atomic<size_t> head_{0};     // next block to consume
+    alignas(64) std::atomic<size_t> tail_{0};     // next block to fill
+    std::atomic<bool> closed_{false};             // producer is done
+    std::atomic<bool> cancelled_{false};          // consumer is done (e.g. on error)
+
+    RingWaits full_waits_{}, empty_waits_{};      // each only written by its own side
+
+    template <typename Ready>
+    static void wait_for(const Ready & ready, RingWaits & waits) {
+        if (ready()) {
+            return;
+        }
+        const auto start = std::chrono::steady_clock::now();
+        for (unsigned spins = 0; not ready(); spins++) {
+            if (spins < 64) {
+                std::this_thread::yield();
+            } else {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        }
+        waits.n_waits++;
+        waits.time += std::chrono::steady_clock::now() - start;
+    }
+
+    public:
+    explicit LineRing(const size_t n_slots) : slots_(n_slots) {}
+
+    /* Producer: wait for a free block to fill, or nullptr if the consumer cancelled */
+    LineBlock * producer_block() {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        wait_for([&] { return tail - head_.load(std::memory_order_acquire) < slots_.size()
+                              or cancelled_.load(std::memory_order_relaxed); }, full_waits_);
+        if (cancelled_.load(std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return &slots_[tail % slots_.size()];
+    }
+
+    /* Producer: publish the block from producer_block() */
+    void push() {
+        tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /* Producer: no more blocks will be pushed */
+    void close() {
+        closed_.store(true, std::memory_order_release);
+    }
+
+    /* Consumer: wait for the next filled block, or nullptr once the producer closed and all are consumed */
+    const LineBlock * consumer_block() {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        wait_for([&] { return tail_.load(std::memory_order_acquire) != head
+                              or closed_.load(std::memory_order_acquire); }, empty_waits_);
+        if (tail_.load(std::memory_order_acquire) == head) {
+            return nullptr;
+        }
+        return &slots_[head % slots_.size()];
+    }
+
+    /* Consumer: free the block from consumer_block() */
+    void pop() {
+        head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /* Consumer: stop the producer (it gets no more blocks) */
+    void cancel() {
+        cancelled_.store(true, std::memory_order_relaxed);
+    }
+
+    // read once both sides are done
+    const RingWaits & full_waits() const { return full_waits_; }
+    const RingWaits & empty_waits() const { return empty_waits_; }
+    size_t n_blocks() const { return tail_.load(); }
+};
+
+/* Read fd to end of file into ring, as blocks of whole lines (the last line may lack a newline).
+ * Stops early if the consumer cancels. Returns the number of bytes read.
+ * The caller closes the ring afterwards (including on error). */
+uint64_t read_lines_into(const int fd, LineRing & ring) {
+    uint64_t n_bytes = 0;
+    std::string partial;    // start of the line the last block ended in
+    bool eof = false;
+
+    while (not eof) {
+        LineBlock * const block = ring.producer_block();
+        if (not block) {
+            break;
+        }
+        if (block->buffer.size() < std::max(LINE_BLOCK_SIZE, 2 * partial.size())) {
+            block->buffer.resize(std::max(LINE_BLOCK_SIZE, 2 * partial.size()));
+        }
+        memcpy(block->buffer.data(), partial.data(), partial.size());
+        size_t size = partial.size();
+        size_t lines_end = 0;
+
+        // fill the block, until it holds at least one whole line
+        while (true) {
+            while (size < block->buffer.size()) {
+                const ssize_t n_read = read(fd, block->buffer.data() + size, block->buffer.size() - size);
+                if (n_read < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    throw std::runtime_error(std::string("error reading input: ") + strerror(errno));
+                }
+                if (n_read == 0) {
+                    eof = true;
+                    break;
+                }
+                size += n_read;
+                n_bytes += n_read;
+            }
+
+            if (eof) {
+                lines_end = size;
+                break;
+            }
+            const std::string_view contents{block->buffer.data(), size};
+            const size_t last_newline = contents.rfind('\n');
+            if (last_newline != contents.npos) {
+                lines_end = last_newline + 1;
+                break;
+            }
+            block->buffer.resize(2 * block->buffer.size());   // line longer than the block
+        }
+
+        partial.assign(block->buffer.data() + lines_end, size - lines_end);
+        block->size = lines_end;
+        ring.push();
+    }
+
+    return n_bytes;
+}
+
+#endif
@@ -1,21 +1,23 @@
 #!/bin/bash
 # Installs dependencies for analyze, preconfinterval, and confinterval 
-# Tested on Ubuntu 19.10
-    # Changes for 18.04:
-        # jemalloc package may not have a .pc file for pkg-config
-        # boost include: container_hash => functional
-        # g++8 for charconv
+# Requires Ubuntu 22.04 or newer: building needs g++ 11 or newer (for floating-point to_chars/from_chars),
+# the default g++ since 22.04. Earlier releases (previously tested: 19.10, 18.04) can't build the programs.
         
 # TODO: add matplotlib, python3
 
+source /etc/lsb-release
+if dpkg --compare-versions "$DISTRIB_RELEASE" lt 22.04; then
+    echo "Ubuntu $DISTRIB_RELEASE is too old: g++ 11 or newer (Ubuntu 22.04 or newer) is required" >&2
+    exit 1
+fi
+
 # (private only) add InfluxData repo
 wget -qO- https://repos.influxdata.com/influxdb.key | sudo apt-key add -
-source /etc/lsb-release
 echo "deb https://repos.influxdata.com/${DISTRIB_ID,,} ${DISTRIB_CODENAME} stable" | sudo tee /etc/apt/sources.list.d/influxdb.list
 
 # get libs
 sudo apt-get update
-libs=("jemalloc" "jsoncpp" "sparsehash" "boost-all" "crypto++")
+libs=("jemalloc" "jsoncpp" "sparsehash" "boost-all" "zstd")
 for lib in ${libs[@]}; do
     sudo apt-get install -y lib${lib}-dev
 done
@@ -24,7 +26,7 @@ done
 sudo apt-get install -y libdbd-pg-perl 
 
 # get tools 
-tools=("influxdb" "gnuplot" "pkg-config") # pkg-config needed for configure
+tools=("g++" "influxdb" "gnuplot" "pkg-config") # pkg-config needed for configure
 for tool in ${tools[@]}; do
     sudo apt-get install -y $tool
 done
@@ -0,0 +1,174 @@
+/* Benchmark of split_on_char() (splitutil.hh): the original one-byte-at-a-time loop against
+ * each SIMD block scanner the build supports (and AVX2 followed by SSE2, as split_on_char() scans
+ * with AVX2), all built with the same flags.
+ * Each splits every line as the tools do: an Influx export line on ' ', then its tag set on ','
+ * and its field on '=' (as influx_to_csv); a stream statistics line on ' ', then each field on '='
+ * (as stream_to_scheme_stats). All must produce the same fields. */
+
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <stdexcept>
+#include <optional>
+#include "splitutil.hh"
+#include "mmaputil.hh"
+
+using namespace std;
+
+using SplitFn = void (*)(string_view, char, vector<string_view> &);
+
+/* split_on_char() before the SIMD scanners, verbatim */
+void original_split_on_char(const string_view str, const char ch_to_find, vector<string_view> & ret) {
+    ret.clear();
+
+    bool in_double_quoted_string = false;
+    unsigned int field_start = 0;   // start of next token
+    for (unsigned int i = 0; i < str.size(); i++) {
+        const char ch = str[i];
+        if (ch == '"') {
+            in_double_quoted_string = !in_double_quoted_string;
+        } else if (in_double_quoted_string) {
+            continue;
+        } else if (ch == ch_to_find) {
+            ret.emplace_back(str.substr(field_start, i - field_start));
+            field_start = i + 1;
+        }
+    }
+
+    ret.emplace_back(str.substr(field_start));
+}
+
+/* Splits lines of one kind (Influx export or stream statistics) as its tool does */
+class LineSplitter {
+    bool influx_;
+    vector<string_view> fields_{}, subfields_{};
+
+    public:
+    explicit LineSplitter(const bool influx) : influx_(influx) {}
+
+    /* Split each line, calling on_field with each field (and subfield) split out */
+    template <SplitFn split_fn, typename FieldFn>
+    void split(const vector<string_view> & lines, FieldFn on_field) {
+        for (const auto line : lines) {
+            split_fn(line, ' ', fields_);
+            for (size_t i = 0; i < fields_.size(); i++) {
+                on_field(fields_[i]);
+                const char delim = influx_ ? (i == 0 ? ',' : i == 1 ? '=' : '\0') : '=';
+                if (delim == '\0') {
+                    continue;
+                }
+                split_fn(fields_[i], delim, subfields_);
+                for (const auto subfield : subfields_) {
+                    on_field(subfield);
+                }
+            }
+        }
+    }
+};
+
+/* Lines of filename, skipping empty lines and comments, DDL and DML of an export */
+vector<string_view> read_lines(const string & filename, const MappedFile & file) {
+    vector<string_view> lines;
+    for_each_line(file.contents(), [&](const string_view line) {
+        if (not line.empty() and line.front() != '#' and line.substr(0, 6) != "CREATE"sv) {
+            lines.emplace_back(line);
+        }
+    });
+    if (lines.empty()) {
+        throw runtime_error(filename + ": no lines");
+    }
+    return lines;
+}
+
+/* Times split_on_char() variants on lines (best of repetitions), checking each splits out the same fields */
+class SplitBench {
+    vector<string_view> lines_;
+    size_t n_bytes_ = 0;
+    LineSplitter splitter_;
+    unsigned repetitions_;
+    optional<uint64_t> expected_hash_{};    // of the fields split out by the first variant run
+    double original_s_ = 0;
+
+    public:
+    SplitBench(const vector<string_view> & lines, const bool influx, const unsigned repetitions)
+        : lines_(lines), splitter_(influx), repetitions_(repetitions)
+    {
+        for (const auto line : lines_) {
+            n_bytes_ += line.size();
+        }
+        cout << lines_.size() << " lines, mean length " << fixed << setprecision(1)
+             << double(n_bytes_) / lines_.size() << " bytes\n";
+    }
+
+    template <SplitFn split_fn>
+    void run(const string & name) {
+        // must split out exactly the fields of the first variant run (the original loop):
+        // hash the position and length of each, in order (FNV-1a)
+        uint64_t hash = 14695981039346656037ULL;
+        const char * const base = lines_.front().data();
+        splitter_.split<split_fn>(lines_, [&](const string_view field) {
+            for (const uint64_t word : {uint64_t(field.data() - base), uint64_t(field.size())}) {
+                hash = (hash ^ word) * 1099511628211ULL;
+            }
+        });
+        if (not expected_hash_.has_value()) {
+            expected_hash_ = hash;
+        } else if (hash != expected_hash_.value()) {
+            throw runtime_error(name + " splits differently from the original loop");
+        }
+
+        double best_s = 1e9;
+        size_t n_fields = 0;
+        for (unsigned rep = 0; rep < repetitions_; rep++) {
+            n_fields = 0;
+            const auto start = chrono::steady_clock::now();
+            splitter_.split<split_fn>(lines_, [&](const string_view) { n_fields++; });
+            best_s = min(best_s, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+        }
+        if (original_s_ == 0) {
+            original_s_ = best_s;
+        }
+        cout << "  " << left << setw(14) << name + ":" << right << setprecision(1)
+             << setw(6) << lines_.size() / best_s / 1e6 << " Mlines/s, "
+             << setw(6) << n_bytes_ / best_s / 1e6 << " MB/s, " << setprecision(2)
+             << original_s_ / best_s << "x (" << n_fields << " fields)\n";
+    }
+};
+
+void bench_file(const string & filename, const bool influx, const unsigned repetitions) {
+    const MappedFile file(filename);
+    cout << filename << ": ";
+    SplitBench bench(read_lines(filename, file), influx, repetitions);
+
+    bench.run<original_split_on_char>("original loop");
+#if defined(__SSE2__)
+    bench.run<split_on_char_blocks<split_block_sse2>>("SSE2");
+#endif
+#if defined(__AVX2__)
+    bench.run<split_on_char_blocks<split_block_avx2>>("AVX2");
+    bench.run<split_on_char_blocks<split_block_avx2, split_block_sse2>>("AVX2+SSE2");
+#endif
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 1) {
+        abort();
+    }
+    if (argc != 3 and argc != 4) {
+        cerr << "Usage: " << argv[0] << " influx_export stream_stats [repetitions]\n"
+             << "stream_stats: output of csv_to_stream_stats (e.g. ts=... valid=... lines).\n";
+        return EXIT_FAILURE;
+    }
+    try {
+        const unsigned repetitions = argc == 4 ? stoul(argv[3]) : 10;
+        bench_file(argv[1], true, repetitions);
+        bench_file(argv[2], false, repetitions);
+    } catch (const exception & e) {
+        cerr << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,292 @@
+/* Benchmark of simulate_realization() (stallsimutil.hh), which stream_to_scheme_stats's point estimate
+ * calls 10000 times per scheme, against the version it replaced: that one searched for non-empty
+ * neighbor bins on every draw and recorded each simulated sample in a SchemeStats.
+ * Each scheme's stall ratios come from a file of stream statistics (every stream whose watch time
+ * falls in a bin); watch times come from a watch times file. Both versions draw from the same
+ * PRNG streams of a fixed seed, so must simulate the same stall ratios: bit-identical, except where
+ * the compiler fuses a multiply and add (e.g. with -march=native on FMA hardware) in one but not the other. */
+
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <optional>
+#include "stallsimutil.hh"
+#include "splitutil.hh"
+#include "floatutil.hh"
+
+using namespace std;
+using namespace std::literals;
+
+// Simulated stall ratios of the two versions may differ by rounding (see above), but no more
+static constexpr double MAX_RELATIVE_DIFFERENCE = 1e-12;
+
+/* The parts of stream_to_scheme_stats's SchemeStats used to simulate */
+struct SchemeStallStats {
+    BinnedStallRatios binned_stall_ratios{};
+
+    unsigned int samples = 0;
+    double total_watch_time = 0;
+    double total_stall_time = 0;
+
+    // add stall ratio to appropriate bin
+    void add_sample(const double watch_time, const double stall_time) {
+        binned_stall_ratios.at(watch_time_bin(watch_time)).push_back(stall_time / watch_time);
+
+        samples++;
+        total_watch_time += watch_time;
+        total_stall_time += stall_time;
+    }
+
+    double observed_stall_ratio() const {
+        return total_stall_time / total_watch_time;
+    }
+};
+
+/* simulate_realization() before StallRatioSampler, verbatim (but for SchemeStats) */
+class NeighborSearchSimulation {
+    /* Draw from aggregate over the pair of neighbor bins nhops away from the simulated watch time on each side
+     * (e.g. the direct left and right bins, if nhops == 1). */
+    static optional<double> draw_from_neighbor_bins(double simulated_watch_time, unsigned nhops,
+                                                    CounterPRNG & prng,
+                                                    const SchemeStallStats & /* real */ scheme ) {
+
+        unsigned int simulated_watch_time_binned = watch_time_bin(simulated_watch_time);
+
+        if (nhops > MAX_BIN - MIN_BIN) {
+            throw logic_error("Attempted to draw from pair of bins " + to_string(nhops) + " away from bin " +
+                              to_string(simulated_watch_time_binned) +
+                              ". Valid bins (inclusive): " + to_string(MIN_BIN) + ":" + to_string(MAX_BIN));
+        }
+
+        // unused if neighbor is out of range, since num_samples will be 0
+        unsigned int left_neighbor = simulated_watch_time_binned - nhops;
+        unsigned int right_neighbor = simulated_watch_time_binned + nhops;
+        const size_t left_num_stall_ratio_samples = simulated_watch_time_binned < MIN_BIN + nhops ?
+                                                    0 :
+                                                    scheme.binned_stall_ratios.at(left_neighbor).size();
+        const size_t right_num_stall_ratio_samples = simulated_watch_time_binned > MAX_BIN - nhops ?
+                                                    0 :
+                                                    scheme.binned_stall_ratios.at(right_neighbor).size();
+
+        if (left_num_stall_ratio_samples == 0 && right_num_stall_ratio_samples == 0) {
+            /* Both neighbors empty. Do not throw -- caller may repeat with a larger nhops. */
+            return {};
+        }
+
+        uniform_int_distribution<> agg_possible_stall_ratio_index(0, left_num_stall_ratio_samples +
+                                                                     right_num_stall_ratio_samples - 1);
+        const unsigned agg_stall_ratio_index = agg_possible_stall_ratio_index(prng);
+        unsigned stall_ratio_index, selected_neighbor;   // stall_ratio_index: relative to nsamples in chosen bin
+
+        if (agg_stall_ratio_index >= left_num_stall_ratio_samples) {    // right bin
+            selected_neighbor = right_neighbor;
+            stall_ratio_index = agg_stall_ratio_index - left_num_stall_ratio_samples;
+        } else {                                                        // left bin
+            selected_neighbor = left_neighbor;
+            stall_ratio_index = agg_stall_ratio_index;
+        }
+        const double simulated_stall_time = simulated_watch_time *
+            scheme.binned_stall_ratios.at(selected_neighbor).at(stall_ratio_index);
+
+        return simulated_stall_time;
+    }
+
+    static pair<double, double> simulate(const vector<double> & watch_times,
+                                         CounterPRNG & prng,
+                                         const SchemeStallStats & /* real */ scheme ) {
+        /* step 1: draw a random watch time from static watch times samples */
+        uniform_int_distribution<> possible_watch_time_index(0, watch_times.size() - 1);
+        const double simulated_watch_time = watch_times.at(possible_watch_time_index(prng));
+
+        /* step 2: draw a stall ratio for the scheme from a similar observed watch time */
+        unsigned int simulated_watch_time_binned = watch_time_bin(simulated_watch_time);
+
+        size_t num_stall_ratio_samples = scheme.binned_stall_ratios.at(simulated_watch_time_binned).size();
+
+        if (num_stall_ratio_samples > 0) {
+            // scheme has nonempty bin corresponding to the simulated watch time =>
+            // draw stall ratio from that bin
+            uniform_int_distribution<> possible_stall_ratio_index(0, num_stall_ratio_samples - 1);
+            // multiply stall ratio by un-binned simulated watch time, since stall ratio uses un-binned real watch time
+            const double simulated_stall_time = simulated_watch_time *
+                scheme.binned_stall_ratios.at(simulated_watch_time_binned).at(possible_stall_ratio_index(prng));
+
+            return {simulated_watch_time, simulated_stall_time};
+        } else {
+            unsigned nhops = 1;
+            optional<double> simulated_stall_time;
+            while (not (simulated_stall_time = draw_from_neighbor_bins(simulated_watch_time, nhops++, prng, scheme))) {
+                /* Draw from aggregate over the pair of bins one hop away, two hops, etc until finding a non-empty bin.
+                 * Should always terminate, since at least one bin in the distribution should be non-empty
+                 * (but draw_from_neighbor_bins checks just in case) */
+            }
+
+            return {simulated_watch_time, simulated_stall_time.value()};
+        }
+    }
+
+    public:
+    /* For each sample in (real) scheme, take a simulated sample
+     * Return resulting simulated total stall ratio */
+    static double simulate_realization( const vector<double> & watch_times,
+                                        CounterPRNG & prng,
+                                        const SchemeStallStats & /* real */scheme ) {
+        SchemeStallStats scheme_simulated;
+
+        for ( unsigned int i = 0; i < scheme.samples; i++ ) {
+            const auto [watch_time, stall_time] = simulate(watch_times, prng, scheme);
+            scheme_simulated.add_sample(watch_time, stall_time);
+        }
+
+        return scheme_simulated.observed_stall_ratio();
+    }
+};
+
+/* Value of a "key=value" field, checking its key */
+double field_value(const string_view field, const string_view key, vector<string_view> & scratch) {
+    split_on_char(field, '=', scratch);
+    double value;
+    if (scratch.size() != 2 or scratch[0] != key or not parse_floating(scratch[1], value)) {
+        throw runtime_error("expected " + string(key) + "=<number>, got " + string(field));
+    }
+    return value;
+}
+
+/* Each scheme's stall statistics, from every stream (in stream_stats) with a watch time in a bin */
+map<string, SchemeStallStats> read_scheme_stats(const string & stream_stats_filename) {
+    ifstream stream_stats_file{stream_stats_filename};
+    if (not stream_stats_file.is_open()) {
+        throw runtime_error("can't open " + stream_stats_filename);
+    }
+    map<string, SchemeStallStats> scheme_stats;
+    string line;
+    vector<string_view> fields, scratch;
+    while (getline(stream_stats_file, line)) {
+        if (line.empty() or line.front() == '#') {
+            continue;
+        }
+        split_on_char(line, ' ', fields);
+        if (fields.size() != N_STREAM_STATS) {
+            throw runtime_error("expected " + to_string(N_STREAM_STATS) + " fields: " + line);
+        }
+        const double watch_time = field_value(fields[12], "total_after_startup"sv, scratch);
+        const double stall_time = field_value(fields[13], "stall_after_startup"sv, scratch);
+        if (watch_time < (1 << MIN_BIN) or watch_time >= (1 << (MAX_BIN + 1))) {
+            continue;
+        }
+        split_on_char(fields[4], '=', scratch);
+        if (scratch.size() != 2 or scratch[0] != "scheme"sv) {
+            throw runtime_error("expected scheme=<name>, got " + string(fields[4]));
+        }
+        scheme_stats[string(scratch[1])].add_sample(watch_time, stall_time);
+    }
+    if (scheme_stats.empty()) {
+        throw runtime_error(stream_stats_filename + ": no streams");
+    }
+    return scheme_stats;
+}
+
+/* Watch times (from stream_stats_to_metadata --build-watchtimes-list), in the file's order */
+vector<double> read_watch_times(const string & watch_times_filename) {
+    ifstream watch_times_file{watch_times_filename};
+    string line_storage;
+    if (not getline(watch_times_file, line_storage)) {
+        throw runtime_error("error reading " + watch_times_filename);
+    }
+    vector<double> watch_times;
+    istringstream line(line_storage);
+    double watch_time;
+    while (line >> watch_time) {
+        watch_times.emplace_back(watch_time);
+    }
+    if (watch_times.empty()) {
+        throw runtime_error(watch_times_filename + ": no watch times");
+    }
+    return watch_times;
+}
+
+void stall_sim_bench(const string & stream_stats_filename, const string & watch_times_filename,
+                     const unsigned iterations, const uint64_t seed) {
+    const map<string, SchemeStallStats> scheme_stats = read_scheme_stats(stream_stats_filename);
+    const vector<double> watch_times = read_watch_times(watch_times_filename);
+    vector<BinnedWatchTime> binned_watch_times;
+    for (const double watch_time : watch_times) {
+        binned_watch_times.push_back({watch_time, watch_time_bin(watch_time)});
+    }
+    cout << watch_times.size() << " watch times, " << iterations << " iterations per scheme, seed " << seed << "\n";
+
+    using clock = chrono::steady_clock;
+    double total_old_s = 0, total_new_s = 0, max_relative_difference = 0;
+    uint64_t total_samples = 0;
+    for (const auto & [name, scheme] : scheme_stats) {
+        // the sampler is built once per scheme (in Realizations), so its construction is timed too
+        const auto new_start = clock::now();
+        const StallRatioSampler sampler(scheme.binned_stall_ratios);
+        vector<double> new_ratios;
+        for (unsigned i = 0; i < iterations; i++) {
+            CounterPRNG prng{seed, i};
+            new_ratios.push_back(simulate_realization(binned_watch_times, prng, scheme.samples, sampler));
+        }
+        const double new_s = chrono::duration<double>(clock::now() - new_start).count();
+
+        const auto old_start = clock::now();
+        vector<double> old_ratios;
+        for (unsigned i = 0; i < iterations; i++) {
+            CounterPRNG prng{seed, i};
+            old_ratios.push_back(NeighborSearchSimulation::simulate_realization(watch_times, prng, scheme));
+        }
+        const double old_s = chrono::duration<double>(clock::now() - old_start).count();
+
+        unsigned n_identical = 0;
+        for (unsigned i = 0; i < iterations; i++) {
+            const double difference = abs(new_ratios[i] - old_ratios[i]);
+            if (difference > MAX_RELATIVE_DIFFERENCE * abs(old_ratios[i])) {
+                throw runtime_error(name + ": simulated stall ratio " + to_string(i) + " differs from "
+                                    "the neighbor search version by " + to_string(difference));
+            }
+            n_identical += new_ratios[i] == old_ratios[i];
+            if (difference > 0) {
+                max_relative_difference = max(max_relative_difference, difference / abs(old_ratios[i]));
+            }
+        }
+
+        const uint64_t samples = uint64_t(iterations) * scheme.samples;
+        cout << name << " (" << scheme.samples << " streams): " << fixed << setprecision(1)
+             << samples / old_s / 1e6 << " -> " << samples / new_s / 1e6 << " M samples/s, "
+             << setprecision(2) << old_s / new_s << "x (" << n_identical << " of " << iterations
+             << " realizations bit-identical)\n";
+        total_old_s += old_s;
+        total_new_s += new_s;
+        total_samples += samples;
+    }
+    cout << "all schemes: " << fixed << setprecision(1) << total_samples / total_old_s / 1e6 << " -> "
+         << total_samples / total_new_s / 1e6 << " M samples/s, " << setprecision(2)
+         << total_old_s / total_new_s << "x (" << setprecision(3) << total_old_s << " s -> "
+         << total_new_s << " s), largest relative difference " << scientific << setprecision(1)
+         << max_relative_difference << "\n";
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 1) {
+        abort();
+    }
+    if (argc < 3 or argc > 5) {
+        cerr << "Usage: " << argv[0] << " stream_stats watch_times [iterations [seed]]\n"
+             << "stream_stats: output of csv_to_stream_stats; watch_times: output of "
+             << "stream_stats_to_metadata --build-watchtimes-list (default: 100 iterations, seed 1).\n";
+        return EXIT_FAILURE;
+    }
+    try {
+        stall_sim_bench(argv[1], argv[2], argc > 3 ? stoul(argv[3]) : 100, argc > 4 ? stoull(argv[4]) : 1);
+    } catch (const exception & e) {
+        cerr << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,165 @@
+/* Simulation of a scheme's stall ratio, by resampling real watch times and stall ratios
+ * (see stream_to_scheme_stats's point estimate) */
+
+#ifndef STALLSIMUTIL_HH
+#define STALLSIMUTIL_HH
+
+#include <array>
+#include <vector>
+#include <string>
+#include <random>
+#include <limits>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include "confintutil.hh"
+
+/* Counter-based pseudorandom generator: the nth output is a fixed function of (seed, stream, n),
+ * so any number of independent streams can be drawn from one seed, in any order or thread.
+ * Each output is the SplitMix64 finalizer applied to the nth step of a Weyl sequence. */
+class CounterPRNG {
+    uint64_t key_;
+    uint64_t counter_ = 0;
+
+    static constexpr uint64_t mix(uint64_t x) {
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
+    static constexpr uint64_t GOLDEN_GAMMA = 0x9e3779b97f4a7c15ULL;
+
+    public:
+    using result_type = uint64_t;
+
+    CounterPRNG(const uint64_t seed, const uint64_t stream) : key_(mix(seed + mix(stream + GOLDEN_GAMMA))) {}
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+    result_type operator()() { return mix(key_ + ++counter_ * GOLDEN_GAMMA); }
+};
+
+/* Given watch time in seconds, return bin index as
+ * log(watch time), if watch time : [2^MIN_BIN, 2^MAX_BIN] (else, throw) */
+unsigned int watch_time_bin(const double raw_watch_time) {
+    const unsigned int watch_time_bin = lrintf(floorf(log2(raw_watch_time)));
+    if (watch_time_bin < MIN_BIN or watch_time_bin > MAX_BIN) {
+        throw std::runtime_error("watch time bin out of range");
+    }
+    return watch_time_bin;
+}
+
+/* Stall ratios of a scheme's (real) streams, binned by watch time */
+using BinnedStallRatios = std::array<std::vector<double>, MAX_N_BINS>;
+
+/* A watch time to sample from, with its bin precomputed */
+struct BinnedWatchTime {
+    double watch_time;
+    unsigned int bin;
+};
+
+/* Draws a stall ratio for a given watch time bin from a scheme's (real) stall ratio distribution,
+ * in O(1) without allocating.
+ * If the scheme's bin corresponding to the watch time is non-empty, draws from that bin.
+ * Otherwise, draws from the aggregate over the pair of neighbor bins nhops away on each side
+ * (e.g. the direct left and right bins, if nhops == 1), for the smallest nhops such that either
+ * neighbor is non-empty.
+ * The bins (or neighbor pairs) to draw from are found once, at construction. */
+class StallRatioSampler {
+    // stall ratios of all bins, contiguous in bin order
+    std::vector<double> _stall_ratios{};
+
+    // range of _stall_ratios to draw from for a bin: left neighbor (or the bin itself), then right neighbor
+    struct BinSource {
+        uint32_t left_offset{0}, left_count{0};
+        uint32_t right_offset{0}, right_count{0};
+    };
+    std::array<BinSource, MAX_N_BINS> _sources{};
+
+    public:
+    explicit StallRatioSampler( const BinnedStallRatios & /* real */ binned_stall_ratios ) {
+        std::array<uint32_t, MAX_N_BINS> offsets{};
+        for (unsigned int bin = MIN_BIN; bin <= MAX_BIN; bin++) {
+            offsets[bin] = _stall_ratios.size();
+            _stall_ratios.insert(_stall_ratios.end(), binned_stall_ratios[bin].begin(),
+                                 binned_stall_ratios[bin].end());
+        }
+        const auto bin_size = [&binned_stall_ratios](const unsigned int bin) -> uint32_t {
+            return binned_stall_ratios[bin].size();
+        };
+
+        for (unsigned int bin = MIN_BIN; bin <= MAX_BIN; bin++) {
+            BinSource & source = _sources[bin];
+            if (bin_size(bin) > 0) {
+                source.left_offset = offsets[bin];
+                source.left_count = bin_size(bin);
+                continue;
+            }
+            /* Neighbors out of range are empty; if all bins are empty, source is left empty
+             * (the scheme then has no samples to simulate) */
+            for (unsigned int nhops = 1; nhops <= MAX_BIN - MIN_BIN; nhops++) {
+                if (bin >= MIN_BIN + nhops) {
+                    source.left_offset = offsets[bin - nhops];
+                    source.left_count = bin_size(bin - nhops);
+                }
+                if (bin + nhops <= MAX_BIN) {
+                    source.right_offset = offsets[bin + nhops];
+                    source.right_count = bin_size(bin + nhops);
+                }
+                if (source.left_count + source.right_count > 0) {
+                    break;
+                }
+            }
+        }
+    }
+
+    double draw( const unsigned int bin, CounterPRNG & prng ) const {
+        const BinSource & source = _sources[bin];
+        if (source.left_count + source.right_count == 0) {
+            throw std::logic_error("Attempted to draw stall ratio for bin " + std::to_string(bin) +
+                                   ", but all bins are empty");
+        }
+
+        std::uniform_int_distribution<> possible_stall_ratio_index(0, source.left_count + source.right_count - 1);
+        const uint32_t stall_ratio_index = possible_stall_ratio_index(prng);
+        if (stall_ratio_index < source.left_count) {
+            return _stall_ratios[source.left_offset + stall_ratio_index];
+        }
+        return _stall_ratios[source.right_offset + stall_ratio_index - source.left_count];
+    }
+};
+
+/* For each of a scheme's (real) samples, take a simulated sample:
+ * draw a random watch time from all watch times;
+ * draw a stall ratio from the bin corresponding to the simulated watch time,
+ * in the per-scheme stall ratio distribution
+ * representing the input to analyze.
+ * Return resulting simulated total stall ratio */
+double simulate_realization( const std::vector<BinnedWatchTime> & watch_times,
+                             CounterPRNG & prng,
+                             const unsigned int samples,
+                             const StallRatioSampler & stall_ratios ) {
+    double total_watch_time = 0;
+    double total_stall_time = 0;
+
+    std::uniform_int_distribution<> possible_watch_time_index(0, watch_times.size() - 1);
+    for ( unsigned int i = 0; i < samples; i++ ) {
+        /* step 1: draw a random watch time from static watch times samples */
+        const auto [simulated_watch_time, simulated_watch_time_binned] =
+            watch_times[possible_watch_time_index(prng)];
+
+        /* step 2: draw a stall ratio for the scheme from a similar observed watch time;
+         * multiply stall ratio by un-binned simulated watch time,
+         * since stall ratio uses un-binned real watch time */
+        const double simulated_stall_time = simulated_watch_time *
+            stall_ratios.draw(simulated_watch_time_binned, prng);
+
+        total_watch_time += simulated_watch_time;
+        total_stall_time += simulated_stall_time;
+    }
+
+    return total_stall_time / total_watch_time;
+}
+
+#endif
@@ -17,6 +17,10 @@
 #include <set>
 #include "dateutil.hh"
 #include "confintutil.hh"
+#include "splitutil.hh"
+#include "floatutil.hh"
+#include "columnutil.hh"
+#include "metricsutil.hh"
 
 #include <sys/time.h>
 #include <sys/resource.h>
@@ -25,7 +29,8 @@ using namespace std;
 using namespace std::literals;
 
 /** 
- * From stdin, parses output of analyze, which contains one line per stream summary.
+ * From stdin, parses output of analyze, which contains one line per stream summary
+ * (or reads the same summaries from columnar tables, see --columnar-in).
  * Takes *one* of the following actions:
  * 1. Write a list of days each scheme has run (used to find intersection)
  * 2. Find the intersection of multiple schemes' days (used to determine the dates to analyze)
@@ -51,26 +56,6 @@ size_t memcheck() {
     return usage.ru_maxrss;
 }
 
-void split_on_char(const string_view str, const char ch_to_find, vector<string_view> & ret) {
-    ret.clear();
-
-    bool in_double_quoted_string = false;
-    unsigned int field_start = 0;
-    for (unsigned int i = 0; i < str.size(); i++) {
-        const char ch = str[i];
-        if (ch == '"') {
-            in_double_quoted_string = !in_double_quoted_string;
-        } else if (in_double_quoted_string) {
-            continue;
-        } else if (ch == ch_to_find) {
-            ret.emplace_back(str.substr(field_start, i - field_start));
-            field_start = i + 1;
-        }
-    }
-
-    ret.emplace_back(str.substr(field_start));
-}
-
 uint64_t to_uint64(string_view str) {
     uint64_t ret = -1;
     const auto [ptr, ignore] = from_chars(str.data(), str.data() + str.size(), ret);
@@ -82,29 +67,6 @@ uint64_t to_uint64(string_view str) {
     return ret;
 }
 
-double to_double(const string_view str) {
-    /* sadly, g++ 8 doesn't seem to have floating-point C++17 from_chars() yet
-       float ret;
-       const auto [ptr, ignore] = from_chars(str.data(), str.data() + str.size(), ret);
-       if (ptr != str.data() + str.size()) {
-       throw runtime_error("could not parse as float: " + string(str));
-       }
-
-       return ret;
-       */
-
-    /* apologies for this */
-    char * const null_byte = const_cast<char *>(str.data() + str.size());
-    char old_value = *null_byte;
-    *null_byte = 0;
-
-    const double ret = atof(str.data());
-
-    *null_byte = old_value;
-
-    return ret;
-}
-
 class SchemeDays {
 
     /* For each scheme, records all unique days the scheme ran, 
@@ -121,11 +83,17 @@ class SchemeDays {
 
     public: 
     // Populate scheme_days or watch_times map
-    SchemeDays (const string & list_filename, Action action): 
+    SchemeDays (const string & list_filename, Action action, const vector<string> & columnar_filenames): 
                 list_filename(list_filename) {  
         if (action == SCHEMEDAYS_LIST or action == WATCHTIMES_LIST) {
-            // populate from stdin (i.e. analyze output)
-            parse_stdin(action); 
+            if (columnar_filenames.empty()) {
+                // populate from stdin (i.e. analyze output)
+                parse_stdin(action); 
+            } else {
+                for (const string & columnar_filename : columnar_filenames) {
+                    parse_columnar(columnar_filename, action);
+                }
+            }
         } else if (action == INTERSECT) {
             // populate from input file 
             read_scheme_days();
@@ -138,6 +106,7 @@ class SchemeDays {
         string line_storage;
 
         unsigned int line_no = 0;
+        uint64_t n_bytes = 0;
 
         vector<string_view> fields;
 
@@ -149,6 +118,7 @@ class SchemeDays {
 
             getline(cin, line_storage);
             line_no++;
+            n_bytes += line_storage.size() + 1;
 
             const string_view line{line_storage};
 
@@ -186,6 +156,29 @@ class SchemeDays {
                 record_watch_time(mean_delivery_rate, time_after_startup);
             }
         }   
+        metrics().count(line_no, n_bytes);
+    }
+
+    /* Populate scheme_days or watch_times map from a columnar table of stream summaries,
+     * reading only the columns the action needs */
+    void parse_columnar(const string & columnar_filename, Action action) {
+        const ColumnarReader table{columnar_filename};
+        cerr << columnar_filename << ": " << table.n_rows() << " streams\n";
+        metrics().count(table.n_rows(), table.size());
+
+        if (action == SCHEMEDAYS_LIST) {
+            const vector<uint64_t> timestamps = table.timestamps("ts");
+            const vector<string_view> schemes = table.strings("scheme");
+            for (size_t row = 0; row < table.n_rows(); row++) {
+                record_scheme_day(timestamps[row], schemes[row]);
+            }
+        } else if (action == WATCHTIMES_LIST) {
+            const vector<double> delivery_rates = table.float64s("mean_delivery_rate");
+            const vector<double> watch_times = table.float64s("total_after_startup");
+            for (size_t row = 0; row < table.n_rows(); row++) {
+                record_watch_time(delivery_rates[row], watch_times[row]);
+            }
+        }
     }
 
     void record_watch_time(const string_view & mean_delivery_rate, 
@@ -202,7 +195,10 @@ class SchemeDays {
             throw runtime_error("watch time field mismatch");
         }
 
-        const double watch_time = to_double(scratch[1]);
+        record_watch_time(delivery_rate, to_double(scratch[1]));
+    }
+
+    void record_watch_time(const double delivery_rate, const double watch_time) {
         if (watch_time < (1 << MIN_BIN) or watch_time > (1 << MAX_BIN)) {
             return;   // TODO: check this is what we want. Also, should we ignore wt > max in confint? rn, would throw
         }
@@ -231,7 +227,10 @@ class SchemeDays {
             throw runtime_error("scheme field mismatch");
         }
 
-        string_view schemesv = scratch[1];
+        record_scheme_day(ts, scratch[1]);
+    }
+
+    void record_scheme_day(const uint64_t ts, const string_view schemesv) {
         Day_sec day = ts2Day_sec(ts);
         scheme_days[string(schemesv)].emplace(day);
     }
@@ -390,9 +389,12 @@ class SchemeDays {
 };
 
 void stream_stats_to_metadata_main(const string & list_filename, const string & desired_schemes,
-                      const string & intersection_filename, Action action) {
+                      const string & intersection_filename, Action action,
+                      const vector<string> & columnar_filenames) {
     // Populates schemedays/watchtimes map from input data or file
-    SchemeDays scheme_days {list_filename, action};
+    metrics().start_phase("parse");
+    SchemeDays scheme_days {list_filename, action, columnar_filenames};
+    metrics().start_phase("write");
     if (action == SCHEMEDAYS_LIST) {
         /* Scheme days map => scheme days file */
         scheme_days.write_scheme_days(); 
@@ -407,7 +409,8 @@ void stream_stats_to_metadata_main(const string & list_filename, const string &
 }
 
 void print_usage(const string & program) {
-    cerr << "Usage: " << program << " <list_filename> <action>\n" 
+    cerr << "Usage: " << program << " <list_filename> <action> [--columnar-in <filename>]..."
+            " [--metrics-out <metrics_filename>]\n" 
          << "Action: One of\n" 
          << "\t --build-schemedays-list: Read analyze output from stdin, and write to list_filename "
             "the list of days each scheme was run \n"
@@ -415,7 +418,11 @@ void print_usage(const string & program) {
             "(i.e. primary, vintages, or comma-separated list e.g. mpc/bbr,puffer_ttp_cl/bbr), "
             "read from list_filename, and write to intersection_filename the schemes and intersecting days\n"
          << "\t --build-watchtimes-list: Read analyze output from stdin, and write the watch times to "
-            "slow_list_filename and all_list_filename (separate file for slow streams)\n";
+            "slow_list_filename and all_list_filename (separate file for slow streams)\n"
+         << "--columnar-in: read analyze output from this columnar table (e.g. from "
+            "csv_to_stream_stats --columnar-out) instead of stdin; may be repeated\n"
+         << "--metrics-out: write wall and CPU time, throughput, peak RSS, and allocator statistics "
+            "of each phase (parse, write) to metrics_filename as JSON\n";
 }
 
 int main(int argc, char *argv[]) {
@@ -429,14 +436,18 @@ int main(int argc, char *argv[]) {
             {"intersect-schemes", required_argument, nullptr, 's'},
             {"intersect-outfile", required_argument, nullptr, 'o'},
             {"build-watchtimes-list", no_argument, nullptr, 'w'},
+            {"columnar-in", required_argument, nullptr, 'c'},
+            {"metrics-out", required_argument, nullptr, 'm'},
             {nullptr, 0, nullptr, 0}
         };
         Action action = NONE;
+        vector<string> columnar_filenames;
         string desired_schemes; 
         string intersection_filename;
+        string metrics_filename;
 
         while (true) {
-            const int opt = getopt_long(argc, argv, "ds:o:w", actions, nullptr);
+            const int opt = getopt_long(argc, argv, "ds:o:wc:m:", actions, nullptr);
             if (opt == -1) break;
             switch (opt) {
                 case 'd':
@@ -473,6 +484,12 @@ int main(int argc, char *argv[]) {
                     }
                     action = WATCHTIMES_LIST;
                     break;
+                case 'c':
+                    columnar_filenames.emplace_back(optarg);
+                    break;
+                case 'm':
+                    metrics_filename = optarg;
+                    break;
                 default:
                     print_usage(argv[0]);
                     return EXIT_FAILURE;
@@ -491,7 +508,11 @@ int main(int argc, char *argv[]) {
         }
 
         string list_filename = argv[optind];     
-        stream_stats_to_metadata_main(list_filename, desired_schemes, intersection_filename, action);
+        stream_stats_to_metadata_main(list_filename, desired_schemes, intersection_filename, action,
+                                      columnar_filenames);
+        if (not metrics_filename.empty()) {
+            metrics().write(metrics_filename, "stream_stats_to_metadata");
+        }
 
     } catch (const exception & e) {
         cerr << e.what() << "\n";
@@ -15,8 +15,16 @@
 #include <getopt.h>
 #include <cassert>
 #include <set>
+#include <thread>
+#include <atomic>
+#include <exception>
 #include "dateutil.hh"
 #include "confintutil.hh"
+#include "stallsimutil.hh"
+#include "splitutil.hh"
+#include "floatutil.hh"
+#include "columnutil.hh"
+#include "metricsutil.hh"
 
 #include <sys/time.h>
 #include <sys/resource.h>
@@ -25,7 +33,8 @@ using namespace std;
 using namespace std::literals;
 
 /** 
- * From stdin, parses output of analyze, which contains one line per stream summary.
+ * From stdin, parses output of analyze, which contains one line per stream summary
+ * (or reads the same summaries from columnar tables, see --columnar-in).
  * To stdout, outputs each scheme's mean stall ratio, SSIM, and SSIM variance,
  * along with confidence intervals. 
  * Takes as mandatory arguments the file containing desired schemes and the days they intersect 
@@ -57,26 +66,6 @@ size_t memcheck() {
     return usage.ru_maxrss;
 }
 
-void split_on_char(const string_view str, const char ch_to_find, vector<string_view> & ret) {
-    ret.clear();
-
-    bool in_double_quoted_string = false;
-    unsigned int field_start = 0;
-    for (unsigned int i = 0; i < str.size(); i++) {
-        const char ch = str[i];
-        if (ch == '"') {
-            in_double_quoted_string = !in_double_quoted_string;
-        } else if (in_double_quoted_string) {
-            continue;
-        } else if (ch == ch_to_find) {
-            ret.emplace_back(str.substr(field_start, i - field_start));
-            field_start = i + 1;
-        }
-    }
-
-    ret.emplace_back(str.substr(field_start));
-}
-
 uint64_t to_uint64(string_view str) {
     uint64_t ret = -1;
     const auto [ptr, ignore] = from_chars(str.data(), str.data() + str.size(), ret);
@@ -88,29 +77,6 @@ uint64_t to_uint64(string_view str) {
     return ret;
 }
 
-double to_double(const string_view str) {
-    /* sadly, g++ 8 doesn't seem to have floating-point C++17 from_chars() yet
-       float ret;
-       const auto [ptr, ignore] = from_chars(str.data(), str.data() + str.size(), ret);
-       if (ptr != str.data() + str.size()) {
-       throw runtime_error("could not parse as float: " + string(str));
-       }
-
-       return ret;
-       */
-
-    /* apologies for this */
-    char * const null_byte = const_cast<char *>(str.data() + str.size());
-    char old_value = *null_byte;
-    *null_byte = 0;
-
-    const double ret = atof(str.data());
-
-    *null_byte = old_value;
-
-    return ret;
-}
-
 double raw_ssim_to_db(const double raw_ssim) {
     return -10.0 * log10( 1 - raw_ssim );
 }
@@ -118,7 +84,7 @@ double raw_ssim_to_db(const double raw_ssim) {
 
 struct SchemeStats {
      // Stall ratio data from *real* distribution
-    array<vector<double>, MAX_N_BINS> binned_stall_ratios{};
+    BinnedStallRatios binned_stall_ratios{};
 
     unsigned int samples = 0;
     double total_watch_time = 0;
@@ -130,16 +96,6 @@ struct SchemeStats {
 
     double total_ssim_watch_time = 0;
 
-    /* Given watch time in seconds, return bin index as 
-     * log(watch time), if watch time : [2^MIN_BIN, 2^MAX_BIN] (else, throw) */
-    static unsigned int watch_time_bin(const double raw_watch_time) {
-        const unsigned int watch_time_bin = lrintf(floorf(log2(raw_watch_time)));    
-        if (watch_time_bin < MIN_BIN or watch_time_bin > MAX_BIN) {
-            throw std::runtime_error("watch time bin out of range");
-        }
-        return watch_time_bin;
-    }
-
     // add stall ratio to appropriate bin
     void add_sample(const double watch_time, const double stall_time) {
         binned_stall_ratios.at(watch_time_bin(watch_time)).push_back(stall_time / watch_time);
@@ -171,7 +127,7 @@ struct SchemeStats {
 
     double mean_ssim() const {
         double sum = 0;
-        for ( const auto [watch_time, ssim] : ssim_samples ) {
+        for ( const auto & [watch_time, ssim] : ssim_samples ) {
             sum += watch_time * ssim;
         }
         return sum / total_ssim_watch_time;
@@ -180,7 +136,7 @@ struct SchemeStats {
     double stddev_ssim() const {
         const double mean = mean_ssim();
         double ssr = 0;
-        for ( const auto [watch_time, ssim] : ssim_samples ) {
+        for ( const auto & [watch_time, ssim] : ssim_samples ) {
             ssr += watch_time * (ssim - mean) * (ssim - mean);
         }
         const double variance = ssr / total_ssim_watch_time;
@@ -189,7 +145,7 @@ struct SchemeStats {
 
     tuple<double, double, double> sem_ssim() const {
         double sum_squared_weights = 0;
-        for ( const auto [watch_time, ssim] : ssim_samples ) {
+        for ( const auto & [watch_time, ssim] : ssim_samples ) {
             sum_squared_weights += (watch_time * watch_time) / (total_ssim_watch_time * total_ssim_watch_time);
         }
         const double mean = mean_ssim();
@@ -349,6 +305,7 @@ class Statistics {
         string line_storage;
 
         unsigned int line_no = 0;
+        uint64_t n_bytes = 0;
 
         vector<string_view> fields;
         vector<string_view> scratch;
@@ -361,6 +318,7 @@ class Statistics {
 
             getline(cin, line_storage);
             line_no++;
+            n_bytes += line_storage.size() + 1;
 
             const string_view line{line_storage};
 
@@ -461,125 +419,65 @@ class Statistics {
 
             string_view schemesv = scratch[1];
 
-            // Record stall ratio, ssim, ssim variation 
-            // Ignore if not one of the requested schemes 
-            SchemeStats *the_scheme = nullptr;
-            auto found_scheme = scheme_stats.find(string(schemesv));
-            if (found_scheme != scheme_stats.end()) {
-                the_scheme = &found_scheme->second;
-            }
-
-            if (the_scheme) {
-                the_scheme->add_sample(watch_time, stall_time);
-                if ( mean_ssim_val >= 0 ) { the_scheme->add_ssim_sample(watch_time, mean_ssim_val); }
-                // SSIM variation = 0 over a whole stream is questionable
-                if ( ssim_variation_db_val > 0 and ssim_variation_db_val <= 10000 ) { 
-                    the_scheme->add_ssim_variation_sample(ssim_variation_db_val); 
-                }
-            }
+            record_stream(schemesv, watch_time, stall_time, mean_ssim_val, ssim_variation_db_val);
         }   // end while
+        metrics().count(line_no, n_bytes);
     }
 
-    /* Draw from aggregate over the pair of neighbor bins nhops away from the simulated watch time on each side
-     * (e.g. the direct left and right bins, if nhops == 1). */
-    static optional<double> draw_from_neighbor_bins(double simulated_watch_time, unsigned nhops,
-                                                    default_random_engine & prng,
-                                                    const SchemeStats & /* real */ scheme ) {
-        
-        unsigned int simulated_watch_time_binned = SchemeStats::watch_time_bin(simulated_watch_time);
-       
-        if (nhops > MAX_BIN - MIN_BIN) {
-            throw logic_error("Attempted to draw from pair of bins " + to_string(nhops) + " away from bin " +
-                              to_string(simulated_watch_time_binned) + 
-                              ". Valid bins (inclusive): " + to_string(MIN_BIN) + ":" + to_string(MAX_BIN));
-        }
-        
-        // unused if neighbor is out of range, since num_samples will be 0 
-        unsigned int left_neighbor = simulated_watch_time_binned - nhops;    
-        unsigned int right_neighbor = simulated_watch_time_binned + nhops;
-        const size_t left_num_stall_ratio_samples = simulated_watch_time_binned < MIN_BIN + nhops ? 
-                                                    0 :
-                                                    scheme.binned_stall_ratios.at(left_neighbor).size();
-        const size_t right_num_stall_ratio_samples = simulated_watch_time_binned > MAX_BIN - nhops ?
-                                                    0 :
-                                                    scheme.binned_stall_ratios.at(right_neighbor).size();
-        
-        if (left_num_stall_ratio_samples == 0 && right_num_stall_ratio_samples == 0) {
-            /* Both neighbors empty. Do not throw -- caller may repeat with a larger nhops. */
-            return {};
-        }
-
-        uniform_int_distribution<> agg_possible_stall_ratio_index(0, left_num_stall_ratio_samples + 
-                                                                     right_num_stall_ratio_samples - 1); 
-        const unsigned agg_stall_ratio_index = agg_possible_stall_ratio_index(prng);
-        unsigned stall_ratio_index, selected_neighbor;   // stall_ratio_index: relative to nsamples in chosen bin
-        
-        if (agg_stall_ratio_index >= left_num_stall_ratio_samples) {    // right bin
-            selected_neighbor = right_neighbor;
-            stall_ratio_index = agg_stall_ratio_index - left_num_stall_ratio_samples;
-        } else {                                                        // left bin
-            selected_neighbor = left_neighbor;
-            stall_ratio_index = agg_stall_ratio_index;
-        }
-        const double simulated_stall_time = simulated_watch_time * 
-            scheme.binned_stall_ratios.at(selected_neighbor).at(stall_ratio_index);
-        
-        return simulated_stall_time;
-    }
-
-    /* Simulate watch and stall time: 
-     * Draw a random watch time from all watch times; 
-     * draw a stall ratio from the bin corresponding to the simulated watch time, 
-     * in the per-scheme stall ratio distribution
-     * representing the input to analyze.
-     */
-    static pair<double, double> simulate(const vector<double> & watch_times,
-                                         default_random_engine & prng,
-                                         const SchemeStats & /* real */ scheme ) {
-        /* step 1: draw a random watch time from static watch times samples */ 
-        uniform_int_distribution<> possible_watch_time_index(0, watch_times.size() - 1);
-        const double simulated_watch_time = watch_times.at(possible_watch_time_index(prng));
-
-        /* step 2: draw a stall ratio for the scheme from a similar observed watch time */
-        unsigned int simulated_watch_time_binned = SchemeStats::watch_time_bin(simulated_watch_time);
-        
-        size_t num_stall_ratio_samples = scheme.binned_stall_ratios.at(simulated_watch_time_binned).size();
-
-        if (num_stall_ratio_samples > 0) {  
-            // scheme has nonempty bin corresponding to the simulated watch time => 
-            // draw stall ratio from that bin
-            uniform_int_distribution<> possible_stall_ratio_index(0, num_stall_ratio_samples - 1);
-            // multiply stall ratio by un-binned simulated watch time, since stall ratio uses un-binned real watch time
-            const double simulated_stall_time = simulated_watch_time * 
-                scheme.binned_stall_ratios.at(simulated_watch_time_binned).at(possible_stall_ratio_index(prng));
-
-            return {simulated_watch_time, simulated_stall_time};
-        } else {
-            unsigned nhops = 1; 
-            optional<double> simulated_stall_time;
-            while (not (simulated_stall_time = draw_from_neighbor_bins(simulated_watch_time, nhops++, prng, scheme))) {
-                /* Draw from aggregate over the pair of bins one hop away, two hops, etc until finding a non-empty bin.
-                 * Should always terminate, since at least one bin in the distribution should be non-empty 
-                 * (but draw_from_neighbor_bins checks just in case) */
+    /* As parse_stdin(), from a columnar table of stream summaries
+     * (reading only the columns used, and applying the same filters in the same order) */
+    void parse_columnar(const string & columnar_filename, const string & stream_speed) {
+        const ColumnarReader table{columnar_filename};
+        const size_t rss = memcheck() / 1024;
+        cerr << columnar_filename << ": " << table.n_rows() << " streams, RSS=" << rss << " MiB\n";
+        metrics().count(table.n_rows(), table.size());
+
+        const vector<uint64_t> timestamps = table.timestamps("ts");
+        const vector<double> delivery_rates = stream_speed == "slow" ? table.float64s("mean_delivery_rate")
+                                                                     : vector<double>{};
+        const vector<double> watch_times = table.float64s("total_after_startup");
+        const vector<double> stall_times = table.float64s("stall_after_startup");
+        const vector<double> mean_ssims = table.float64s("mean_ssim");
+        const vector<double> ssim_variations = table.float64s("ssim_variation_db");
+        const vector<string_view> validities = table.strings("valid");
+        const vector<string_view> schemes = table.strings("scheme");
+
+        for (size_t row = 0; row < table.n_rows(); row++) {
+            if (not ts_is_acceptable(timestamps[row])) {
+                continue;
             }
-
-            return {simulated_watch_time, simulated_stall_time.value()};
+            if (stream_speed == "slow" and not stream_is_slow(delivery_rates[row])) {
+                continue;
+            }
+            if (watch_times[row] < (1 << MIN_BIN)) {
+                continue;
+            }
+            // EXCLUDE BAD (but not trunc)
+            if (validities[row] == "bad"sv) {
+                continue;
+            }
+            record_stream(schemes[row], watch_times[row], stall_times[row], mean_ssims[row], ssim_variations[row]);
         }
     }
 
-    /* For each sample in (real) scheme, take a simulated sample 
-     * Return resulting simulated total stall ratio */
-    static double simulate_realization( const vector<double> & watch_times,
-                                        default_random_engine & prng,
-                                        const SchemeStats & /* real */scheme ) {
-        SchemeStats scheme_simulated;
-
-        for ( unsigned int i = 0; i < scheme.samples; i++ ) {
-            const auto [watch_time, stall_time] = simulate(watch_times, prng, scheme);
-            scheme_simulated.add_sample(watch_time, stall_time);	    
+    /* Record stall ratio, ssim, ssim variation of an accepted stream
+     * Ignore if not one of the requested schemes */
+    void record_stream(const string_view schemesv, const double watch_time, const double stall_time,
+                       const double mean_ssim_val, const double ssim_variation_db_val) {
+        SchemeStats *the_scheme = nullptr;
+        auto found_scheme = scheme_stats.find(string(schemesv));
+        if (found_scheme != scheme_stats.end()) {
+            the_scheme = &found_scheme->second;
+        }
+
+        if (the_scheme) {
+            the_scheme->add_sample(watch_time, stall_time);
+            if ( mean_ssim_val >= 0 ) { the_scheme->add_ssim_sample(watch_time, mean_ssim_val); }
+            // SSIM variation = 0 over a whole stream is questionable
+            if ( ssim_variation_db_val > 0 and ssim_variation_db_val <= 10000 ) { 
+                the_scheme->add_ssim_variation_sample(ssim_variation_db_val); 
+            }
         }
-
-        return scheme_simulated.observed_stall_ratio();
     }
 
     class Realizations {
@@ -588,13 +486,21 @@ class Statistics {
         vector<double> _stall_ratios{};
         // real (non-simulated) stats
         SchemeStats _scheme_sample;
+        // real stall ratio distribution
+        StallRatioSampler _stall_ratio_sampler;
 
         public:
-        Realizations( const string & name, const SchemeStats & scheme_sample ) : _name(name), _scheme_sample(scheme_sample) {}
+        Realizations( const string & name, const SchemeStats & scheme_sample ) 
+            : _name(name), _scheme_sample(scheme_sample), _stall_ratio_sampler(scheme_sample.binned_stall_ratios) {}
+
+        // simulated stall ratio (not yet recorded)
+        double realization( const vector<BinnedWatchTime> & watch_times, 
+                            CounterPRNG & prng ) const {
+            return simulate_realization(watch_times, prng, _scheme_sample.samples, _stall_ratio_sampler);
+        }
 
-        void add_realization( const vector<double> & watch_times, 
-                              default_random_engine & prng ) {
-            _stall_ratios.push_back(simulate_realization(watch_times, prng, _scheme_sample));   // pass in real stats
+        void add_realizations( const vector<double> & stall_ratios ) {
+            _stall_ratios.insert(_stall_ratios.end(), stall_ratios.begin(), stall_ratios.end());
         }
 
         // mean and 95% confidence interval of *simulated* stall ratios
@@ -631,29 +537,65 @@ class Statistics {
     };
 
     /* For each scheme: simulate stall ratios, and calculate stall ratio mean/CI over simulated samples.
-     * Calculate SSIM and SSIMvar mean/CI over real samples. */
-    void do_point_estimate() {
-        random_device rd;
-        default_random_engine prng(rd());
+     * Calculate SSIM and SSIMvar mean/CI over real samples.
+     * Iterations are split into contiguous ranges across n_threads threads; iteration i draws from
+     * its own PRNG stream (seed, i), so results depend only on the seed. */
+    void do_point_estimate(const unsigned n_threads, const uint64_t seed) {
+        cerr << "Bootstrap seed: " << seed << "\n";
 
         // initialize with real stats, from which to sample
         constexpr unsigned int iteration_count = 10000; 
+        vector<BinnedWatchTime> binned_watch_times;
+        for (const double watch_time : watch_times) {
+            binned_watch_times.push_back({watch_time, watch_time_bin(watch_time)});
+        }
         vector<Realizations> realizations;
         for (const auto & [desired_scheme, desired_scheme_stats] : scheme_stats) {
             realizations.emplace_back(Realizations{desired_scheme, desired_scheme_stats});
         }
 
         /* For each scheme, take 10000 simulated stall ratios */
-        for (unsigned int i = 0; i < iteration_count; i++) {
-            if (i % 10 == 0) {
-                cerr << "\rsample " << i << "/" << iteration_count << "                    ";
+        const unsigned n_workers = min(n_threads, iteration_count);
+        // stall_ratios[worker][scheme] = simulated stall ratios, in iteration order
+        vector<vector<vector<double>>> stall_ratios(n_workers, vector<vector<double>>(realizations.size()));
+        vector<exception_ptr> worker_errors(n_workers);
+        atomic<unsigned int> iterations_done{0};
+        vector<thread> workers;
+        for (unsigned w = 0; w < n_workers; w++) {
+            workers.emplace_back([&, w] {
+                try {
+                    for (unsigned int i = iteration_count * w / n_workers; 
+                         i < iteration_count * (w + 1) / n_workers; i++) {
+                        if (w == 0 and i % 10 == 0) {
+                            cerr << "\rsample " << iterations_done << "/" << iteration_count << "                    ";
+                        }
+
+                        CounterPRNG prng{seed, i};
+                        for (size_t scheme = 0; scheme < realizations.size(); scheme++) {
+                            stall_ratios[w][scheme].push_back(realizations[scheme].realization(binned_watch_times, prng));
+                        }
+                        iterations_done++;
+                    }
+                } catch (...) {
+                    worker_errors[w] = current_exception();
+                }
+            });
+        }
+        for (auto & worker : workers) {
+            worker.join();
+        }
+        for (const auto & worker_error : worker_errors) {
+            if (worker_error) {
+                rethrow_exception(worker_error);
             }
+        }
+        cerr << "\n";
 
-            for (auto & realization : realizations) {
-                realization.add_realization(watch_times, prng);
+        for (const auto & worker_stall_ratios : stall_ratios) {
+            for (size_t scheme = 0; scheme < realizations.size(); scheme++) {
+                realizations[scheme].add_realizations(worker_stall_ratios[scheme]);
             }
         }
-        cerr << "\n";
 
         /* report statistics */
         for (const auto & realization : realizations) {
@@ -666,22 +608,41 @@ class Statistics {
 };
 
 void stream_to_scheme_stats_main(const string & intersection_filename, const string & watch_times_filename,
-                                 const string & stream_speed) {
+                                 const string & stream_speed, const unsigned n_threads, const uint64_t seed,
+                                 const vector<string> & columnar_filenames) {
+    metrics().start_phase("read_metadata");
     Statistics stats {intersection_filename, watch_times_filename, stream_speed};
-    stats.parse_stdin(stream_speed);
-    stats.do_point_estimate(); 
+    metrics().start_phase("parse");
+    if (columnar_filenames.empty()) {
+        stats.parse_stdin(stream_speed);
+    } else {
+        for (const string & columnar_filename : columnar_filenames) {
+            stats.parse_columnar(columnar_filename, stream_speed);
+        }
+    }
+    metrics().start_phase("bootstrap");
+    stats.do_point_estimate(n_threads, seed); 
 }
 
 void print_usage(const string & program) {
     cerr << "Usage: " << program 
          << " --scheme-intersection <intersection_filename>"
             " --stream-speed <stream_speed>"
-            " --watch-times <watch_times_filename_postfix>\n"
+            " --watch-times <watch_times_filename_postfix>"
+            " [--threads <n>] [--seed <seed>] [--columnar-in <filename>]..."
+            " [--metrics-out <metrics_filename>]\n"
             "intersection_filename: Output of stream_stats_to_metadata --intersect-schemes --intersect-outfile, "
             "containing desired schemes and the days they intersect.\n"
             "stream-speed: slow or all\n"
             "watch_times_filename_postfix: Output of stream_stats_to_metadata --build-watch_times-list, "
-            "containing watch times (specified stream_speed will be prepended).\n";
+            "containing watch times (specified stream_speed will be prepended).\n"
+            "threads: number of threads simulating stall ratios (default: number of CPUs).\n"
+            "seed: seed for simulated stall ratios (default: random); "
+            "results are reproducible given the same seed, for any number of threads.\n"
+            "columnar-in: read stream summaries from this columnar table (e.g. from "
+            "csv_to_stream_stats --columnar-out) instead of stdin; may be repeated.\n"
+            "metrics_filename: write wall and CPU time, throughput, peak RSS, and allocator statistics "
+            "of each phase (read_metadata, parse, bootstrap) to metrics_filename as JSON.\n";
 }
 
 int main(int argc, char *argv[]) {
@@ -693,13 +654,21 @@ int main(int argc, char *argv[]) {
             {"scheme-intersection", required_argument, nullptr, 'i'},
             {"stream-speed", required_argument, nullptr, 's'},
             {"watch-times", required_argument, nullptr, 'w'},
+            {"threads", required_argument, nullptr, 't'},
+            {"seed", required_argument, nullptr, 'r'},
+            {"columnar-in", required_argument, nullptr, 'c'},
+            {"metrics-out", required_argument, nullptr, 'o'},
             {nullptr, 0, nullptr, 0}
         };
         string intersection_filename, watch_times_filename,
                stream_speed;
+        unsigned n_threads = max(thread::hardware_concurrency(), 1U);
+        optional<uint64_t> seed;
+        vector<string> columnar_filenames;
+        string metrics_filename;
         
         while (true) {
-            const int opt = getopt_long(argc, argv, "i:s:w:", opts, nullptr);
+            const int opt = getopt_long(argc, argv, "i:s:w:t:r:c:o:", opts, nullptr);
             if (opt == -1) break;
             switch (opt) {
                 case 'i': 
@@ -716,6 +685,23 @@ int main(int argc, char *argv[]) {
                 case 'w':
                     watch_times_filename = optarg;
                     break;
+                case 't':
+                    n_threads = to_uint64(optarg);
+                    if (n_threads == 0) {
+                        cerr << "Error: Number of threads must be positive\n\n";
+                        print_usage(argv[0]);
+                        return EXIT_FAILURE;
+                    }
+                    break;
+                case 'r':
+                    seed = to_uint64(optarg);
+                    break;
+                case 'c':
+                    columnar_filenames.emplace_back(optarg);
+                    break;
+                case 'o':
+                    metrics_filename = optarg;
+                    break;
                 default:
                     print_usage(argv[0]);
                     return EXIT_FAILURE;
@@ -732,7 +718,16 @@ int main(int argc, char *argv[]) {
             return EXIT_FAILURE;
         }
 
-        stream_to_scheme_stats_main(intersection_filename, watch_times_filename, stream_speed); 
+        if (not seed) {
+            random_device rd;
+            seed = (uint64_t(rd()) << 32) | rd();
+        }
+
+        stream_to_scheme_stats_main(intersection_filename, watch_times_filename, stream_speed,
+                                    n_threads, seed.value(), columnar_filenames); 
+        if (not metrics_filename.empty()) {
+            metrics().write(metrics_filename, "stream_to_scheme_stats");
+        }
         
     } catch (const exception & e) {
         cerr << e.what() << "\n";
@@ -0,0 +1,549 @@
+/* Per-stream summaries (validity, rebuffering, SSIM, delivery rate) of anonymized events and chunks,
+ * shared by csv_to_stream_stats (which reads them from the public CSVs) and
+ * influx_to_csv --stream-stats (which hands them over as it dumps, with no CSV round trip) */
+
+#ifndef STREAMSTATSUTIL_HH
+#define STREAMSTATSUTIL_HH
+
+#include <stdexcept>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <tuple>
+#include <map>
+#include <fstream>
+#include <google/dense_hash_map>
+#include <boost/functional/hash.hpp>
+#include <cmath>
+#include <sstream>
+#include <algorithm>
+#include <thread>
+#include <exception>
+#include <charconv>
+
+#include <jsoncpp/json/json.h>
+
+#include "analyzeutil.hh"
+#include "columnutil.hh"
+#include "metricsutil.hh"
+
+#define MAX_SSIM 0.99999    // max acceptable raw SSIM (exclusive)
+// ignore SSIM ~ 1
+optional<double> raw_ssim_to_db(const double raw_ssim) {
+    if (raw_ssim > MAX_SSIM) return nullopt;
+    return -10.0 * log10( 1 - raw_ssim );
+}
+
+/* Columns of a stream statistics table (see StreamStats::analyze_streams()),
+ * named as the fields of a text stream statistics line */
+static const vector<ColumnSpec> STREAM_STATS_COLUMNS = {
+    {"ts", ColumnType::timestamp}, {"valid", ColumnType::string}, {"full_extent", ColumnType::string},
+    {"bad_reason", ColumnType::string}, {"scheme", ColumnType::string}, {"extent", ColumnType::float64},
+    {"used", ColumnType::float64}, {"mean_ssim", ColumnType::float64},
+    {"mean_delivery_rate", ColumnType::float64}, {"average_bitrate", ColumnType::float64},
+    {"ssim_variation_db", ColumnType::float64}, {"startup_delay", ColumnType::float64},
+    {"total_after_startup", ColumnType::float64}, {"stall_after_startup", ColumnType::float64}
+};
+
+/* Value as written to a text stream statistics line (fixed, 6 decimals), so that readers
+ * get the same results from a columnar table as from text */
+double as_printed(const double value) {
+    char printed[400];  // enough for any double in fixed notation
+    const auto [end, ec] = to_chars(printed, printed + sizeof printed, value, chars_format::fixed, 6);
+    double ret;
+    if (ec != errc() or not parse_floating(string_view(printed, end - printed), ret)) {
+        throw runtime_error("could not round-trip " + to_string(value));
+    }
+    return ret;
+}
+
+/* Groups events and chunks by public stream ID, then outputs a summary of each stream
+ * (one stream per line) to stdout, in a deterministic order: streams are ordered by their
+ * session's first event, as added. Not thread-safe; add all events before any chunks. */
+class StreamStats {
+    private:
+        // Convert base64 session ID to a dense id, so stream keys are small and trivially copyable
+        string_table session_ids{};
+
+        // streams[public_stream_id] = vec<[ts, Event]>
+        using stream_key = tuple<uint32_t, unsigned>;   // unpack struct for hash
+        /*                       session_id, index */
+        dense_hash_map<stream_key, vector<pair<uint64_t, Event>>, boost::hash<stream_key>> streams;
+
+        // chunks[public_stream_id] = vec<[ts, VideoSent]>
+        dense_hash_map<stream_key, vector<pair<uint64_t, const VideoSent>>, boost::hash<stream_key>> chunks;
+
+        // Used in summarizing stream, to convert numeric experiment ID to scheme string
+        vector<string> experiments{};
+
+        void read_experimental_settings_dump(const string & filename) {
+            ifstream experiment_dump{ filename };
+            if (not experiment_dump.is_open()) {
+                throw runtime_error( "can't open " + filename );
+            }
+
+            string line_storage;
+
+            while (true) {
+                getline(experiment_dump, line_storage);
+                if (not experiment_dump.good()) {
+                    break;
+                }
+
+                const string_view line{line_storage};
+
+                const size_t separator = line.find_first_of(' ');
+                if (separator == line.npos) {
+                    throw runtime_error("can't find separator: " + line_storage);
+                }
+                const uint64_t experiment_id = to_uint64(line.substr(0, separator));
+                if (experiment_id > numeric_limits<uint16_t>::max()) {
+                    throw runtime_error("invalid expt_id: " + line_storage);
+                }
+                const string_view rest_of_string = line.substr(separator+1);
+                Json::Reader reader;
+                Json::Value doc;
+                reader.parse(string(rest_of_string), doc);
+                experiments.resize(experiment_id + 1);
+                string name = doc["abr_name"].asString();
+                if (name.empty()) {
+                    name = doc["abr"].asString();
+                }
+                // populate experiments with expt_id => abr_name/cc or abr/cc
+                experiments.at(experiment_id) = name + "/" + doc["cc"].asString();
+            }
+        }
+
+    public:
+        StreamStats(const string & experiment_dump_filename)
+            : streams(), chunks()
+        {
+            streams.set_empty_key( {0, -1U} );    // we never insert a stream with index -1
+            chunks.set_empty_key( {0, -1U} );
+
+            read_experimental_settings_dump(experiment_dump_filename);
+        }
+
+        /* Add event to list of events corresponding to its stream.
+         * Only expt_id, type, buffer, and cum_rebuf are used. */
+        void add_event(const string_view session_id, const unsigned index, const uint64_t ts, const Event & event) {
+            streams[{session_ids.forward_map_vivify(session_id), index}].emplace_back(ts, event);
+        }
+
+        /* Add chunk to list of chunks corresponding to its stream.
+         * Only ssim_index, delivery_rate, and size are used. */
+        void add_chunk(const string_view session_id, const unsigned index, const uint64_t ts, const VideoSent & video_sent) {
+            chunks[{session_ids.forward_map_vivify(session_id), index}].emplace_back(ts, video_sent);
+        }
+
+        void print_grouped_data() {
+            cerr << "streams:" << endl;
+            for ( const auto & [stream_id, events] : streams ) {
+                const auto & [session_id, index] = stream_id;
+                cerr << session_ids.reverse_map(session_id) << ", " << index << endl;
+                for ( const auto & [ts, event] : events ) {
+                    cerr << ts << ", " << event;
+                }
+            }
+            // Count total events, streams
+            size_t n_total_events = 0;
+            for ( auto & [unpacked_stream_id, events] : streams ) {
+                n_total_events += events.size();
+            }
+            cerr << "n_total_events " << n_total_events << endl;
+            cerr << "n_total_streams " << streams.size() << endl;
+            cerr << "chunks:" << endl;
+            for ( const auto & [stream_id, stream_chunks] : chunks ) {
+                const auto & [session_id, index] = stream_id;
+                cerr << session_ids.reverse_map(session_id) << ", " << index << endl;
+                for ( const auto & [ts, video_sent] : stream_chunks ) {
+                    cerr << ts << ", " << video_sent;
+                }
+            }
+        }
+
+        /* Corresponds to a line of analyze output; summarizes a stream */
+        struct EventSummary {
+            uint64_t base_time{0};  // lowest ts in stream, in NANOseconds
+            bool valid{false};      // good or bad
+            bool full_extent{true}; // full or trunc
+            float time_extent{0};
+            float cum_rebuf_at_startup{0};
+            float cum_rebuf_at_last_play{0};
+            float time_at_startup{0};
+            float time_at_last_play{0};
+
+            string scheme{};
+            // XXX: not outputting session ID (confinterval doesn't use it)
+
+            /* reason for bad OR trunc (bad_reason != "good" does not necessarily imply the stream is bad --
+             * it may just be trunc) */
+            string bad_reason{};
+        };
+
+        /* Summary of one stream's events and chunks */
+        struct StreamSummary {
+            EventSummary summary{};
+            size_t total_chunks{0}, high_ssim_chunks{0}, ssim_1_chunks{0};
+            double mean_delivery_rate{-1};
+            double mean_ssim{-1}, average_bitrate{-1}, ssim_variation{-1};
+        };
+
+        /* Summarize streams [begin, end) of keys into summaries,
+         * and append their output lines to out (if text) */
+        void summarize_streams(const vector<stream_key> & keys, const size_t begin, const size_t end,
+                               vector<StreamSummary> & summaries, const bool text, string & out) const {
+            ostringstream lines;
+            lines << fixed;
+
+            for (size_t i = begin; i < end; i++) {
+                const EventSummary summary = summarize(streams.find(keys[i])->second);
+
+                /* find matching videosent stream */
+                const auto [normal_ssim_chunks, ssim_1_chunks, total_chunks, ssim_sum,
+                            mean_delivery_rate, average_bitrate, ssim_variation] = video_summarize(keys[i]);
+                const double mean_ssim = ssim_sum == -1 ? -1 : ssim_sum / normal_ssim_chunks;
+                const size_t high_ssim_chunks = total_chunks - normal_ssim_chunks;
+
+                summaries[i] = {summary, total_chunks, high_ssim_chunks, ssim_1_chunks, mean_delivery_rate,
+                                mean_ssim, average_bitrate, ssim_variation};
+                if (not text) {
+                    continue;
+                }
+
+                // ts in anonymized data include nanoseconds -- truncate to seconds
+                lines << "ts=" << (summary.base_time / 1000000000)
+                      << " valid=" << (summary.valid ? "good" : "bad")
+                      << " full_extent=" << (summary.full_extent ? "full" : "trunc" )
+                      << " bad_reason=" << summary.bad_reason
+                      << " scheme=" << summary.scheme
+                      << " extent=" << summary.time_extent
+                      << " used=" << 100 * summary.time_at_last_play / summary.time_extent << "%"
+                      << " mean_ssim=" << mean_ssim
+                      << " mean_delivery_rate=" << mean_delivery_rate
+                      << " average_bitrate=" << average_bitrate
+                      << " ssim_variation_db=" << ssim_variation
+                      << " startup_delay=" << summary.cum_rebuf_at_startup
+                      << " total_after_startup=" << (summary.time_at_last_play - summary.time_at_startup)
+                      << " stall_after_startup=" << (summary.cum_rebuf_at_last_play - summary.cum_rebuf_at_startup)
+                      << "\n";
+            }
+
+            out = lines.str();
+        }
+
+        /* Output a summary of each stream, in order of stream key: to stdout as text, or
+         * if columnar_filename is given, as a columnar table (STREAM_STATS_COLUMNS) in that file.
+         * Either way, totals are output to stdout (as text lines marked with #).
+         * Streams are summarized on n_threads threads (each formats a contiguous range of
+         * streams); totals are then accumulated in stream order, so output doesn't depend on n_threads.
+         * Counts the streams summarized, and bytes of summaries output, in the current metrics phase. */
+        void analyze_streams(const unsigned n_threads, const string & columnar_filename) const {
+            float total_time_after_startup=0;
+            float total_stall_time=0;
+            float total_extent=0;
+
+            unsigned int had_stall=0;
+            unsigned int good_streams=0;
+            unsigned int good_and_full=0;
+
+            unsigned int missing_sysinfo = 0;
+            unsigned int missing_video_stats = 0;
+
+            size_t overall_chunks = 0, overall_high_ssim_chunks = 0, overall_ssim_1_chunks = 0;
+
+            vector<stream_key> keys;
+            keys.reserve(streams.size());
+            for ( const auto & [unpacked_stream_id, events] : streams ) {
+                keys.emplace_back(unpacked_stream_id);
+            }
+            sort(keys.begin(), keys.end());
+
+            // chunks are only summarized as part of a stream (of events)
+            for ( const auto & [unpacked_stream_id, chunk_stream] : chunks ) {
+                if (streams.find(unpacked_stream_id) == streams.end()) {
+                    diagnostics().report("chunks_without_events", [&](ostream & out) {
+                        const auto & [session_id, index] = unpacked_stream_id;
+                        out << "Ignoring " << chunk_stream.size() << " chunks of stream " 
+                            << session_ids.reverse_map(session_id) << ", " << index << " with no events\n";
+                    });
+                }
+            }
+
+            vector<StreamSummary> summaries(keys.size());
+            const size_t n_workers = max(min<size_t>(n_threads, keys.size()), size_t(1));
+            vector<string> outputs(n_workers);
+            vector<exception_ptr> worker_errors(n_workers);
+            vector<thread> workers;
+            for (size_t w = 0; w < n_workers; w++) {
+                workers.emplace_back([&, w] {
+                    try {
+                        summarize_streams(keys, keys.size() * w / n_workers, keys.size() * (w + 1) / n_workers,
+                                          summaries, columnar_filename.empty(), outputs[w]);
+                    } catch (...) {
+                        worker_errors[w] = current_exception();
+                    }
+                });
+            }
+            for (auto & worker : workers) {
+                worker.join();
+            }
+            for (const auto & worker_error : worker_errors) {
+                if (worker_error) {
+                    rethrow_exception(worker_error);
+                }
+            }
+
+            uint64_t n_bytes = 0;
+            for (const auto & output : outputs) {
+                cout << output;
+                n_bytes += output.size();
+            }
+            cout << fixed;
+            if (not columnar_filename.empty()) {
+                n_bytes += write_columnar(columnar_filename, summaries);
+            }
+            metrics().count(summaries.size(), n_bytes);
+
+            for (const auto & [summary, total_chunks, high_ssim_chunks, ssim_1_chunks, mean_delivery_rate,
+                               mean_ssim, average_bitrate, ssim_variation] : summaries) {
+                if (mean_delivery_rate < 0 ) {
+                    missing_video_stats++;
+                } else {
+                    overall_chunks += total_chunks;
+                    overall_high_ssim_chunks += high_ssim_chunks;
+                    overall_ssim_1_chunks += ssim_1_chunks;
+                }
+
+                total_extent += summary.time_extent;
+
+                if (summary.valid) {    // valid = "good"
+                    good_streams++;
+                    total_time_after_startup += (summary.time_at_last_play - summary.time_at_startup);
+                    if (summary.cum_rebuf_at_last_play > summary.cum_rebuf_at_startup) {
+                        had_stall++;
+                        total_stall_time += (summary.cum_rebuf_at_last_play - summary.cum_rebuf_at_startup);
+                    }
+                    if (summary.full_extent) {
+                        good_and_full++;
+                    }
+                }
+            }   // end for
+
+            // mark summary lines with # so confinterval will ignore them
+            cout << "#num_streams=" << streams.size() << " good=" << good_streams << " good_and_full=" << good_and_full << " missing_sysinfo=" << missing_sysinfo << " missing_video_stats=" << missing_video_stats << " had_stall=" << had_stall
+                 << " overall_chunks=" << overall_chunks << " overall_high_ssim_chunks=" << overall_high_ssim_chunks
+                 << " overall_ssim_1_chunks=" << overall_ssim_1_chunks << "\n";
+            cout << "#total_extent=" << total_extent / 3600.0 << " total_time_after_startup=" << total_time_after_startup / 3600.0 << " total_stall_time=" << total_stall_time / 3600.0 << "\n";
+        }
+
+        /* Write summaries as rows of a columnar table, with each value as it would be printed */
+        /* Returns the bytes written */
+        static uint64_t write_columnar(const string & filename, const vector<StreamSummary> & summaries) {
+            ColumnarWriter table{filename, STREAM_STATS_COLUMNS};
+            for (const auto & [summary, total_chunks, high_ssim_chunks, ssim_1_chunks, mean_delivery_rate,
+                               mean_ssim, average_bitrate, ssim_variation] : summaries) {
+                // float expressions are evaluated as for text
+                const float used = 100 * summary.time_at_last_play / summary.time_extent;
+                const float total_after_startup = summary.time_at_last_play - summary.time_at_startup;
+                const float stall_after_startup = summary.cum_rebuf_at_last_play - summary.cum_rebuf_at_startup;
+
+                table.append(0, uint64_t(summary.base_time / 1000000000));
+                table.append(1, summary.valid ? "good"sv : "bad"sv);
+                table.append(2, summary.full_extent ? "full"sv : "trunc"sv);
+                table.append(3, string_view(summary.bad_reason));
+                table.append(4, string_view(summary.scheme));
+                table.append(5, as_printed(summary.time_extent));
+                table.append(6, as_printed(used));
+                table.append(7, as_printed(mean_ssim));
+                table.append(8, as_printed(mean_delivery_rate));
+                table.append(9, as_printed(average_bitrate));
+                table.append(10, as_printed(ssim_variation));
+                table.append(11, as_printed(summary.cum_rebuf_at_startup));
+                table.append(12, as_printed(total_after_startup));
+                table.append(13, as_printed(stall_after_startup));
+                table.end_row();
+            }
+            table.close();
+            return table.bytes_written();
+        }
+
+        /* Summarize a list of Videosents, ignoring SSIM ~ 1 */
+        // normal_ssim_chunks, ssim_1_chunks, total_chunks, ssim_sum, mean_delivery_rate, average_bitrate, ssim_variation]
+        tuple<size_t, size_t, size_t, double, double, double, double> video_summarize(const stream_key & key) const {
+            const auto videosent_it = chunks.find(key);
+            if (videosent_it == chunks.end()) {
+                return { -1, -1, -1, -1, -1, -1, -1 };
+            }
+
+            const vector<pair<uint64_t, const VideoSent>> & chunk_stream = videosent_it->second;
+
+            double ssim_sum = 0;    // raw index
+            double delivery_rate_sum = 0;
+            double bytes_sent_sum = 0;
+            optional<double> ssim_cur_db{};     // empty if index == 1
+            optional<double> ssim_last_db{};    // empty if no previous, or previous had index == 1
+            double ssim_absolute_variation_sum = 0;
+            size_t num_ssim_samples = chunk_stream.size();
+            /* variation is calculated between each consecutive pair of chunks */
+            size_t num_ssim_var_samples = chunk_stream.size() - 1;
+            size_t num_ssim_1_chunks = 0;
+
+            for ( const auto & [ts, videosent] : chunk_stream ) {
+                float raw_ssim = videosent.ssim_index().value(); // would've thrown by this point if not set
+                if (raw_ssim == 1.0) {
+                    num_ssim_1_chunks++;
+                }
+                ssim_cur_db = raw_ssim_to_db(raw_ssim);
+                if (ssim_cur_db.has_value()) {
+                    ssim_sum += raw_ssim;
+                } else {
+                    num_ssim_samples--; // for ssim_mean, ignore chunk with SSIM == 1
+                }
+
+                if (ssim_cur_db.has_value() && ssim_last_db.has_value()) {
+                    ssim_absolute_variation_sum += abs(ssim_cur_db.value() - ssim_last_db.value());
+                } else {
+                    num_ssim_var_samples--; // for ssim_var, ignore pair containing chunk with SSIM == 1
+                }
+
+                ssim_last_db = ssim_cur_db;
+
+                delivery_rate_sum += videosent.delivery_rate().value();
+                bytes_sent_sum += videosent.size().value();
+            }
+
+            const double average_bitrate = 8 * bytes_sent_sum / (2.002 * chunk_stream.size());
+
+            double average_absolute_ssim_variation = -1;
+            if (num_ssim_var_samples > 0) {
+                average_absolute_ssim_variation = ssim_absolute_variation_sum / num_ssim_var_samples;
+            }
+
+            return { num_ssim_samples, num_ssim_1_chunks, chunk_stream.size(), ssim_sum, delivery_rate_sum / chunk_stream.size(), average_bitrate, average_absolute_ssim_variation };
+        }
+
+        /* Summarize a list of events corresponding to a stream. */
+        EventSummary summarize(const vector<pair<uint64_t, Event>> & events) const {
+            EventSummary ret;
+            ret.scheme = experiments.at(events.front().second.expt_id().value());   // All events in stream have same expt_id
+            ret.bad_reason = "good";
+
+            const uint64_t base_time = events.front().first;
+            ret.base_time = base_time;
+            ret.time_extent = (events.back().first - base_time) / double(1000000000);
+
+            bool started = false;
+            bool playing = false;
+
+            float last_sample = 0.0;
+
+            optional<float> time_low_buffer_started;
+            float last_buffer=0, last_cum_rebuf=0;
+
+            /* Break on the first trunc or slow decoder event in the list (if any)
+             * Return early if slow decoder, else set validity based on whether stream is
+             * zeroplayed/never started/negative rebuffer.
+             * Bad_reason != "good" indicates that summary is "bad" or "trunc"
+             * (here "bad" refers to some characteristic of the stream, rather than to
+             * contradictory data points as in an Event) */
+            for ( unsigned int i = 0; i < events.size(); i++ ) {
+                if (not ret.full_extent) {
+                    break;  // trunc, but not necessarily bad
+                }
+
+                const auto & [ts, event] = events[i];
+
+                const float relative_time = (ts - base_time) / 1000000000.0;
+
+                if (relative_time - last_sample > 8.0) {
+                    ret.bad_reason = "event_interval>8s";
+                    ret.full_extent = false;
+                    break;  // trunc, but not necessarily bad
+                }
+
+                if (event.buffer().value() > 0.3) {
+                    time_low_buffer_started.reset();
+                } else {
+                    if (not time_low_buffer_started.has_value()) {
+                        time_low_buffer_started.emplace(relative_time);
+                    }
+                }
+
+                if (time_low_buffer_started.has_value()) {
+                    if (relative_time - time_low_buffer_started.value() > 20) {
+                        // very long rebuffer
+                        ret.bad_reason = "stall>20s";
+                        ret.full_extent = false;
+                        break;      // trunc, but not necessarily bad
+                    }
+                }
+
+                if (event.buffer().value() > 5 and last_buffer > 5) {
+                    if (event.cum_rebuf().value() > last_cum_rebuf + 0.15) {
+                        // stall with plenty of buffer --> slow decoder?
+                        ret.bad_reason = "stall_while_playing";
+                        return ret; // BAD
+                    }
+                }
+
+                switch (event.type().value().type) {
+                    case Event::EventType::Type::init:
+                        break;
+                    case Event::EventType::Type::play:
+                        playing = true;
+                        ret.time_at_last_play = relative_time;
+                        ret.cum_rebuf_at_last_play = event.cum_rebuf().value();
+                        break;
+                    case Event::EventType::Type::startup:
+                        if ( not started ) {
+                            ret.time_at_startup = relative_time;
+                            ret.cum_rebuf_at_startup = event.cum_rebuf().value();
+                            started = true;
+                        }
+
+                        playing = true;
+                        ret.time_at_last_play = relative_time;
+                        ret.cum_rebuf_at_last_play = event.cum_rebuf().value();
+                        break;
+                    case Event::EventType::Type::timer:
+                        if ( playing ) {
+                            ret.time_at_last_play = relative_time;
+                            ret.cum_rebuf_at_last_play = event.cum_rebuf().value();
+                        }
+                        break;
+                    case Event::EventType::Type::rebuffer:
+                        playing = false;
+                        break;
+                }
+
+                last_sample = relative_time;
+                last_buffer = event.buffer().value();
+                last_cum_rebuf = event.cum_rebuf().value();
+            }   // end for
+
+            // zeroplayed and neverstarted are both counted as "didn't begin playing" in paper
+            if (ret.time_at_last_play <= ret.time_at_startup) {
+                ret.bad_reason = "zeroplayed";
+                return ret; // BAD
+            }
+
+            // counted as contradictory data in paper??
+            if (ret.cum_rebuf_at_last_play < ret.cum_rebuf_at_startup) {
+                ret.bad_reason = "negative_rebuffer";
+                return ret; // BAD
+            }
+
+            if (not started) {
+                ret.bad_reason = "neverstarted";
+                return ret; // BAD
+            }
+
+            // good is set here, so validity="bad" iff return early
+            ret.valid = true;
+
+            return ret;
+        }
+};
+
+#endif
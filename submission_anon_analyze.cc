@@ -22,6 +22,8 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <dateutil.hh>
+#include <splitutil.hh>
+#include <floatutil.hh>
 
 using namespace std;
 using namespace std::literals;
@@ -49,27 +51,6 @@ size_t memcheck() {
     return usage.ru_maxrss;
 }
 
-// if delimiter is at end, adds empty string to ret
-void split_on_char(const string_view str, const char ch_to_find, vector<string_view> & ret) {
-    ret.clear();
-
-    bool in_double_quoted_string = false;
-    unsigned int field_start = 0;   // start of next token
-    for (unsigned int i = 0; i < str.size(); i++) {
-        const char ch = str[i];
-        if (ch == '"') {
-            in_double_quoted_string = !in_double_quoted_string;
-        } else if (in_double_quoted_string) {
-            continue;
-        } else if (ch == ch_to_find) {
-            ret.emplace_back(str.substr(field_start, i - field_start));
-            field_start = i + 1;
-        }
-    }
-
-    ret.emplace_back(str.substr(field_start));
-}
-
 uint64_t to_uint64(string_view str) {
     uint64_t ret = -1;
     const auto [ptr, ignore] = from_chars(str.data(), str.data() + str.size(), ret);
@@ -81,29 +62,6 @@ uint64_t to_uint64(string_view str) {
     return ret;
 }
 
-float to_float(const string_view str) {
-    /* sadly, g++ 8 doesn't seem to have floating-point C++17 from_chars() yet
-       float ret;
-       const auto [ptr, ignore] = from_chars(str.data(), str.data() + str.size(), ret);
-       if (ptr != str.data() + str.size()) {
-       throw runtime_error("could not parse as float: " + string(str));
-       }
-
-       return ret;
-       */
-
-    /* apologies for this */
-    char * const null_byte = const_cast<char *>(str.data() + str.size());
-    char old_value = *null_byte;
-    *null_byte = 0;
-
-    const float ret = atof(str.data());
-
-    *null_byte = old_value;
-
-    return ret;
-}
-
 template <typename T>
 T influx_integer(const string_view str) {
     if (str.back() != 'i') {
@@ -0,0 +1,193 @@
+/* zstd-compressed files: block-parallel compression for writers, streaming decompression for readers */
+
+#ifndef ZSTDUTIL_HH
+#define ZSTDUTIL_HH
+
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fstream>
+#include <memory>
+#include <thread>
+#include <exception>
+#include <cstring>
+#include <algorithm>
+
+#include <unistd.h>
+#include <zstd.h>
+
+#include "mmaputil.hh"
+
+// Bytes of input compressed into each independent frame
+static constexpr size_t ZSTD_FRAME_INPUT_SIZE = 4 << 20;
+// Compressed input is released from memory in pieces of this size, as it's decompressed
+static constexpr size_t ZSTD_INPUT_RELEASE_SIZE = 64 << 20;
+
+/* Writes a file as a sequence of independent zstd frames, each compressing ZSTD_FRAME_INPUT_SIZE bytes
+ * of input (the concatenation decompresses as one stream, e.g. with zstd -d).
+ * Input is collected into up to n_threads frames, which are then compressed at once, one per thread,
+ * and written in order. */
+class ZstdFrameWriter {
+    std::string filename_;
+    std::ofstream file_;
+    int level_;
+    std::vector<std::string> frames_;       // input of each frame in the current batch
+    std::vector<std::string> compressed_;
+    size_t n_filled_ = 0;                    // frames_[0, n_filled_) are full
+
+    /* Compress frames_[0, n_frames) in parallel, write them in order, and empty them */
+    void compress_frames(const size_t n_frames) {
+        std::vector<std::exception_ptr> errors(n_frames);
+        const auto compress = [&](const size_t i) {
+            try {
+                std::string & out = compressed_[i];
+                out.resize(ZSTD_compressBound(frames_[i].size()));
+                const size_t size = ZSTD_compress(out.data(), out.size(), frames_[i].data(), frames_[i].size(),
+                                                  level_);
+                if (ZSTD_isError(size)) {
+                    throw std::runtime_error("can't compress " + filename_ + ": " + ZSTD_getErrorName(size));
+                }
+                out.resize(size);
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < n_frames; i++) {
+            workers.emplace_back(compress, i);
+        }
+        compress(0);
+        for (auto & worker : workers) {
+            worker.join();
+        }
+        for (const auto & error : errors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+
+        for (size_t i = 0; i < n_frames; i++) {
+            file_.write(compressed_[i].data(), compressed_[i].size());
+            frames_[i].clear();
+        }
+        n_filled_ = 0;
+    }
+
+    public:
+    ZstdFrameWriter(const std::string & filename, const unsigned n_threads, const int level = ZSTD_CLEVEL_DEFAULT)
+        : filename_(filename), file_(filename, std::ios::binary), level_(level),
+          frames_(std::max(n_threads, 1U)), compressed_(frames_.size())
+    {
+        if (not file_.is_open()) {
+            throw std::runtime_error("can't open " + filename);
+        }
+        for (auto & frame : frames_) {
+            frame.reserve(ZSTD_FRAME_INPUT_SIZE);
+        }
+    }
+
+    void write(std::string_view data) {
+        while (not data.empty()) {
+            std::string & frame = frames_[n_filled_];
+            const size_t len = std::min(data.size(), ZSTD_FRAME_INPUT_SIZE - frame.size());
+            frame.append(data.data(), len);
+            data.remove_prefix(len);
+
+            if (frame.size() == ZSTD_FRAME_INPUT_SIZE and ++n_filled_ == frames_.size()) {
+                compress_frames(frames_.size());
+            }
+        }
+    }
+
+    /* Compress remaining input and close; throws if any write failed */
+    void close() {
+        const size_t n_frames = n_filled_ + not frames_[n_filled_].empty();
+        if (n_frames > 0) {
+            compress_frames(n_frames);
+        }
+        file_.close();
+        if (file_.bad()) {
+            throw std::runtime_error("error writing " + filename_);
+        }
+    }
+};
+
+/* Call fn on each line (without trailing newline) of zstd-compressed filename, decompressing
+ * a buffer at a time, so memory use doesn't grow with the file.
+ * A line is only valid during its call to fn. */
+template <typename LineFn>
+void for_each_line_zstd(const std::string & filename, LineFn fn) {
+    const MappedFile file{filename};
+    const std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> context{ZSTD_createDCtx(), ZSTD_freeDCtx};
+    if (not context) {
+        throw std::runtime_error("can't create zstd context for " + filename);
+    }
+
+    const std::string_view input = file.contents();
+    ZSTD_inBuffer in{input.data(), input.size(), 0};
+    size_t released = 0;
+
+    std::string buffer(4 * ZSTD_DStreamOutSize(), '\0');
+    size_t partial = 0;         // bytes at start of buffer belonging to a line not yet ended
+    bool output_full = false;   // decompressor may hold more output, even if all input is consumed
+    size_t remaining = 0;       // nonzero if a frame is not complete
+
+    while (in.pos < in.size or output_full) {
+        if (partial == buffer.size()) {
+            buffer.resize(2 * buffer.size());  // line longer than buffer
+        }
+        ZSTD_outBuffer out{buffer.data(), buffer.size(), partial};
+        remaining = ZSTD_decompressStream(context.get(), &out, &in);
+        if (ZSTD_isError(remaining)) {
+            throw std::runtime_error("can't decompress " + filename + ": " + ZSTD_getErrorName(remaining));
+        }
+        output_full = out.pos == out.size;
+
+        std::string_view lines{buffer.data(), out.pos};
+        const size_t end_of_lines = lines.rfind('\n');
+        if (end_of_lines != lines.npos) {
+            for_each_line(lines.substr(0, end_of_lines + 1), fn);
+            lines.remove_prefix(end_of_lines + 1);
+        }
+        memmove(buffer.data(), lines.data(), lines.size());
+        partial = lines.size();
+
+        if (in.pos - released >= ZSTD_INPUT_RELEASE_SIZE) {
+            file.release_before(input.data() + in.pos);
+            released = in.pos;
+        }
+    }
+
+    if (remaining != 0) {
+        throw std::runtime_error("truncated zstd file: " + filename);
+    }
+    if (partial > 0) {
+        fn(std::string_view{buffer.data(), partial});
+    }
+}
+
+/* Call fn on each line (without trailing newline) of filename, or if filename doesn't exist,
+ * of its zstd-compressed version (filename.zst). Input is released from memory as it's read.
+ * A line is only valid during its call to fn. */
+template <typename LineFn>
+void for_each_line_in_file(const std::string & filename, LineFn fn) {
+    const std::string compressed_filename = filename + ".zst";
+    if (access(filename.c_str(), F_OK) != 0 and access(compressed_filename.c_str(), F_OK) == 0) {
+        for_each_line_zstd(compressed_filename, fn);
+        return;
+    }
+
+    const MappedFile file{filename};
+    const char * released = file.contents().data();
+    for_each_line(file.contents(), [&](const std::string_view line) {
+        if (size_t(line.data() - released) >= ZSTD_INPUT_RELEASE_SIZE) {
+            file.release_before(line.data());
+            released = line.data();
+        }
+        fn(line);
+    });
+}
+
+#endif